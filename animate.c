@@ -0,0 +1,252 @@
+/*
+    Author: Hugo Roussel, unless indicated otherwise.
+    License: MIT, with parts in CC BY-SA 4.0.
+
+    Render the frames of an animation, changing the points of a scene, and rendering again only what they change.
+
+    The scene is read once, and the image of the previous frame is kept. For each frame, the points are updated
+    in place, and the regions their geoms left or reached are rendered again, over the previous image.
+*/
+
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+
+#include "animate.h"
+#include "image.h"
+#include "stream.h"
+#include "trace.h"
+
+#define LOG_E(FORMAT, ...) fprintf(stderr, "%s:%d ERROR: " FORMAT "\n", __FILE__, __LINE__, __VA_ARGS__);
+
+#define MAX_DIRTY 32 // Regions rendered again for a frame, above they are merged into one
+
+// Regions of a frame to render again, none overlapping another
+typedef struct Dirty {
+    size_t rects[MAX_DIRTY][4]; // x0, y0, x1, y1
+    size_t size;
+} Dirty;
+
+static FILE* _input = NULL;
+static unsigned char* _image = NULL; // The BMP file of the last frame
+static FrameStream* _stream = NULL; // Or the stream the frames go to, holding the last one
+static int _stride = 0;
+static size_t _width = 0;
+static size_t _height = 0;
+
+static int read_input_line(char** line, size_t* len) {
+    return getline(line, len, _input);
+}
+
+static void write_frame_pixel(int x, int y, float pixel[3]) {
+    if (x >= _width || y >= _height) {
+        return;
+    }
+    encode_bitmap_pixel(_image + BITMAP_HEADER_SIZE + ((size_t) y)*_stride + x*BYTES_PER_PIXEL, pixel);
+}
+
+static void write_stream_pixel(int x, int y, float pixel[3]) {
+    if (x >= _width || y >= _height) {
+        return;
+    }
+    encode_stream_pixel(_stream, x, y, pixel);
+}
+
+/* Dirty regions */
+
+// Touching regions are merged too, the pixels along their shared edge would be rendered twice otherwise
+static int overlap(size_t a[4], size_t b[4]) {
+    return a[0] <= b[2] && b[0] <= a[2] && a[1] <= b[3] && b[1] <= a[3];
+}
+
+static void merge_rect(size_t into[4], size_t r[4]) {
+    into[0] = (r[0] < into[0]) ? r[0] : into[0];
+    into[1] = (r[1] < into[1]) ? r[1] : into[1];
+    into[2] = (r[2] > into[2]) ? r[2] : into[2];
+    into[3] = (r[3] > into[3]) ? r[3] : into[3];
+}
+
+static void add_dirty(Dirty* dirty, size_t rect[4]) {
+    if (rect[0] >= rect[2] || rect[1] >= rect[3]) {
+        return; // Empty
+    }
+    size_t r[4] = {rect[0], rect[1], rect[2], rect[3]};
+    // The merged region can overlap regions the parts did not, so start over after each merge
+    for (size_t i = 0; i < dirty->size;) {
+        if (overlap(dirty->rects[i], r)) {
+            merge_rect(r, dirty->rects[i]);
+            memcpy(dirty->rects[i], dirty->rects[--dirty->size], sizeof(r));
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+    if (dirty->size == MAX_DIRTY) {
+        for (size_t i = 0; i < dirty->size; i++) {
+            merge_rect(r, dirty->rects[i]);
+        }
+        dirty->size = 0;
+    }
+    memcpy(dirty->rects[dirty->size++], r, sizeof(r));
+}
+/* === */
+
+static void frame_path(char* path, const char* output, size_t frame) {
+    size_t len = strlen(output);
+    if (len > 4 && strcmp(output + len - 4, ".bmp") == 0) {
+        len -= 4;
+    }
+    snprintf(path, MAX_PATH, "%.*s_%04zu.bmp", (int) len, output, frame);
+}
+
+static int write_frame(const char* output, size_t frame) {
+    double write_start = trace_now();
+    if (_stream) {
+        int res = write_stream_frame(_stream);
+        trace_span("write", frame, write_start);
+        return res;
+    }
+    char path[MAX_PATH];
+    frame_path(path, output, frame);
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        LOG_E("Failed to open output file %s", path);
+        return E_FILE_OPEN;
+    }
+    fwrite(_image, 1, bitmap_size(_width, _height), file);
+    fclose(file);
+    trace_span("write", frame, write_start);
+    return OK;
+}
+
+// Render again the dirty regions of the frame, over the previous one
+static int render_frame(Scene* scene, Dirty* dirty, const char* output, size_t frame) {
+    int res = OK;
+    double frame_start = trace_now();
+    for (size_t i = 0; i < dirty->size && res == OK; i++) {
+        size_t* r = dirty->rects[i];
+        res = render_region(scene, r[0], r[1], r[2], r[3], _stream ? &write_stream_pixel : &write_frame_pixel);
+    }
+    trace_span("frame", frame, frame_start);
+    dirty->size = 0;
+    if (res != OK) {
+        return res;
+    }
+    return write_frame(output, frame);
+}
+
+// Apply one line of the frames file
+static int update_frame(Scene* scene, char* line, Dirty* dirty) {
+    size_t layer, index;
+    float values[4];
+    size_t rect[4] = {0, 0, 0, 0};
+    int res = OK;
+    if (sscanf(line, "MOVE(%zu %zu %f %f)", &layer, &index, &values[0], &values[1]) == 4) {
+        res = update_point(scene, layer, index, values, NULL, NULL, rect);
+    } else if (sscanf(line, "COLOR(%zu %zu %f %f %f %f)", &layer, &index, &values[0], &values[1], &values[2], &values[3]) == 6) {
+        res = update_point(scene, layer, index, NULL, values, NULL, rect);
+    } else if (sscanf(line, "RADIUS(%zu %zu %f)", &layer, &index, &values[0]) == 3) {
+        res = update_point(scene, layer, index, NULL, NULL, values, rect);
+    } else {
+        LOG_E("Unsupported frame change %s", line);
+        return E_ANIMATE_FRAMES;
+    }
+    add_dirty(dirty, rect);
+    return res;
+}
+
+// Write the frames to the stream when set, to BMP files named after output otherwise
+static int animate(const char* input, const char* frames, size_t width, size_t height, size_t threads, const char* output) {
+    int res = OK;
+    FILE* frames_file = NULL;
+    if (frames) {
+        frames_file = fopen(frames, "r");
+        if (frames_file == NULL) {
+            LOG_E("Failed to open frames file %s", frames);
+            return E_FILE_OPEN;
+        }
+    }
+    _input = fopen(input, "r");
+    if (_input == NULL) {
+        LOG_E("Failed to open input file %s", input);
+        if (frames_file) {
+            fclose(frames_file);
+        }
+        return E_FILE_OPEN;
+    }
+    Scene* scene = create_scene();
+    _width = width;
+    _height = height;
+    if (_stream == NULL) {
+        _stride = bitmap_stride(width);
+        _image = calloc(bitmap_size(width, height), 1);
+    }
+    if (scene == NULL || (_stream == NULL && _image == NULL)) {
+        res = E_ALLOC;
+    } else {
+        if (_image) {
+            write_bitmap_headers(_image, width, height);
+        }
+        res = read_animated_scene(scene, width, height, &read_input_line);
+    }
+    fclose(_input);
+
+    // The first frame is rendered whole, with threads
+    if (res == OK) {
+        double frame_start = trace_now();
+        res = render_tiles(scene, width, height, threads, _stream ? &write_stream_pixel : &write_frame_pixel);
+        trace_span("frame", 0, frame_start);
+    }
+    if (res == OK) {
+        res = write_frame(output, 0);
+    }
+
+    size_t frame = 0;
+    int open = 0; // A FRAME was read, and not rendered yet
+    Dirty dirty = {.size = 0};
+    char* line = NULL;
+    size_t len = 0;
+    while (res == OK && frames_file && getline(&line, &len, frames_file) > 0) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0') {
+            continue;
+        }
+        if (strcmp(line, "FRAME") == 0) {
+            if (open) {
+                res = render_frame(scene, &dirty, output, ++frame);
+            }
+            open = 1;
+        } else if (!open) {
+            LOG_E("Frame change before the first FRAME: %s", line);
+            res = E_ANIMATE_FRAMES;
+        } else {
+            res = update_frame(scene, line, &dirty);
+        }
+    }
+    if (res == OK && open) {
+        res = render_frame(scene, &dirty, output, ++frame);
+    }
+
+    free(line);
+    if (frames_file) {
+        fclose(frames_file);
+    }
+    free(_image);
+    _image = NULL;
+    if (scene) {
+        destroy_scene(scene);
+    }
+    return res;
+}
+
+int render_animation(const char* input, const char* frames, size_t width, size_t height, size_t threads, const char* output) {
+    _stream = NULL;
+    return animate(input, frames, width, height, threads, output);
+}
+
+int render_animation_stream(const char* input, const char* frames, size_t width, size_t height, size_t threads, FrameStream* stream) {
+    _stream = stream;
+    int res = animate(input, frames, width, height, threads, NULL);
+    _stream = NULL;
+    return res;
+}
@@ -0,0 +1,28 @@
+/*
+    Author: Hugo Roussel, unless indicated otherwise.
+    License: MIT, with parts in CC BY-SA 4.0.
+
+    Render the frames of an animation, changing the points of a scene, and rendering again only what they change.
+*/
+#ifndef ANIMATE_H
+#define ANIMATE_H
+
+#include "sys/types.h"
+
+#include "render.h"
+#include "stream.h"
+
+#define E_ANIMATE_FRAMES -101
+
+// Render the scene read from input, then once for each frame of the frames file. A frame starts with a FRAME line,
+// followed by the changes of its points, one per line, where L is the index of the layer and I of the point in it:
+//     MOVE(L I X Y)
+//     COLOR(L I R G B A)
+//     RADIUS(L I R)
+// The changes add up from one frame to the next. The frames are written to output_0000.bmp, output_0001.bmp...
+// the scene as read is the frame 0.
+extern int render_animation(const char* input, const char* frames, size_t width, size_t height, size_t threads, const char* output);
+// Same, with the frames written to an open stream instead of files. Without a frames file, only the frame 0 is written.
+extern int render_animation_stream(const char* input, const char* frames, size_t width, size_t height, size_t threads, FrameStream* stream);
+
+#endif
@@ -0,0 +1,335 @@
+/*
+    Author: Hugo Roussel, unless indicated otherwise.
+    License: MIT, with parts in CC BY-SA 4.0.
+
+    Render many small scenes, like icons, in one pass, packed in atlas BMP files.
+
+    Starting a process per scene costs more than rendering a small one, and leaves the other cores idle.
+    Here the scenes are packed in shelves, the tallest first, then a pool of threads take them one by one,
+    each reusing a single Scene, and render them straight into their rectangle of the atlas.
+*/
+
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include "math.h"
+#include "pthread.h"
+
+#include "atlas.h"
+#include "image.h"
+#include "trace.h"
+
+#define LOG_E(FORMAT, ...) fprintf(stderr, "%s:%d ERROR: " FORMAT "\n", __FILE__, __LINE__, __VA_ARGS__);
+
+typedef struct AtlasScene {
+    char* path; // Of the instructions
+    size_t width;
+    size_t height;
+    size_t atlas; // Index of its atlas
+    size_t x; // Top left corner, in the atlas
+    size_t y;
+} AtlasScene;
+
+typedef struct Atlas {
+    size_t width;
+    size_t height;
+    int stride;
+    unsigned char* image; // The whole BMP file
+} Atlas;
+
+typedef struct AtlasQueue {
+    AtlasScene** scenes; // In the order they are rendered, the tallest first
+    size_t size;
+    size_t next; // Next scene to take, shared by the threads
+    Atlas* atlases;
+    int res;
+} AtlasQueue;
+
+/* Scene list */
+
+// Read the list, return the number of scenes or a negative error
+static long read_atlas_list(const char* list, size_t default_width, size_t default_height, AtlasScene** scenes) {
+    FILE* file = fopen(list, "r");
+    if (file == NULL) {
+        LOG_E("Failed to open scene list %s", list);
+        return E_FILE_OPEN;
+    }
+    size_t capacity = 64;
+    size_t size = 0;
+    *scenes = malloc(sizeof(AtlasScene) * capacity);
+    char* line = NULL;
+    size_t len = 0;
+    long res = OK;
+    while (*scenes != NULL && getline(&line, &len, file) > 0) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0') {
+            continue;
+        }
+        AtlasScene s = {line, default_width, default_height, 0, 0, 0};
+        char* size_field = strrchr(line, ' ');
+        if (size_field && sscanf(size_field + 1, "%zux%zu", &s.width, &s.height) == 2) {
+            *size_field = '\0';
+        }
+        if (s.width == 0 || s.height == 0 || s.width > ATLAS_MAX_SIZE || s.height > ATLAS_MAX_SIZE) {
+            LOG_E("Bad size %zux%zu for scene %s, at most %dx%d", s.width, s.height, line, ATLAS_MAX_SIZE, ATLAS_MAX_SIZE);
+            res = E_ATLAS_LIST;
+            break;
+        }
+        if (size == capacity) {
+            capacity *= 2;
+            AtlasScene* grown = realloc(*scenes, sizeof(AtlasScene) * capacity);
+            if (grown == NULL) {
+                res = E_ALLOC;
+                break;
+            }
+            *scenes = grown;
+        }
+        s.path = strdup(line);
+        (*scenes)[size++] = s;
+    }
+    free(line);
+    fclose(file);
+    if (*scenes == NULL) {
+        return E_ALLOC;
+    }
+    if (res != OK) {
+        for (size_t i = 0; i < size; i++) {
+            free((*scenes)[i].path);
+        }
+        return res;
+    }
+    return size;
+}
+/* === */
+
+/* Packing */
+
+static int compare_scene_height(const void* a, const void* b) {
+    AtlasScene* sa = *(AtlasScene**) a;
+    AtlasScene* sb = *(AtlasScene**) b;
+    if (sa->height != sb->height) {
+        return (sa->height < sb->height) - (sa->height > sb->height);
+    }
+    return (sa->width < sb->width) - (sa->width > sb->width);
+}
+
+// Place the scenes in shelves, sorted the tallest first. The atlases are about square, unless a single one is
+// too small for the scenes, then they are ATLAS_MAX_SIZE wide. Return the number of atlases.
+static size_t pack_atlas(AtlasScene** order, size_t size, Atlas* atlases) {
+    qsort(order, size, sizeof(AtlasScene*), &compare_scene_height);
+    double area = 0;
+    size_t widest = 0;
+    for (size_t i = 0; i < size; i++) {
+        area += (double) order[i]->width * order[i]->height;
+        widest = (order[i]->width > widest) ? order[i]->width : widest;
+    }
+    size_t width = (size_t) ceil(sqrt(area * 1.1)); // Shelves leave some room unused
+    width = (width < widest) ? widest : width;
+    width = (width > ATLAS_MAX_SIZE) ? ATLAS_MAX_SIZE : width;
+
+    size_t count = 0;
+    size_t x = 0, y = 0, shelf = 0;
+    atlases[0] = (Atlas){width, 0, 0, NULL};
+    for (size_t i = 0; i < size; i++) {
+        AtlasScene* s = order[i];
+        if (x + s->width > width) {
+            // Next shelf
+            y += shelf;
+            x = 0;
+            shelf = 0;
+        }
+        if (y + s->height > ATLAS_MAX_SIZE) {
+            atlases[++count] = (Atlas){width, 0, 0, NULL};
+            x = 0;
+            y = 0;
+            shelf = 0;
+        }
+        s->atlas = count;
+        s->x = x;
+        s->y = y;
+        x += s->width;
+        shelf = (s->height > shelf) ? s->height : shelf;
+        atlases[count].height = (y + shelf > atlases[count].height) ? y + shelf : atlases[count].height;
+    }
+    return count + 1;
+}
+/* === */
+
+/* Rendering */
+
+// read_scene sets the canvas of render.c for the parsing, so the scenes are read one at a time
+static pthread_mutex_t _read_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE* _scene_file = NULL; // Under _read_lock
+static __thread AtlasScene* _target = NULL; // Scene rendered by the thread
+static __thread Atlas* _target_atlas = NULL;
+
+static int read_scene_line(char** line, size_t* len) {
+    return getline(line, len, _scene_file);
+}
+
+static void write_atlas_pixel(int x, int y, float pixel[3]) {
+    AtlasScene* s = _target;
+    Atlas* a = _target_atlas;
+    if (x >= s->width || y >= s->height) {
+        return;
+    }
+    size_t row = a->height - s->y - s->height + y; // BMP rows go up, the atlas rectangles are from the top
+    encode_bitmap_pixel(a->image + BITMAP_HEADER_SIZE + row*a->stride + (s->x + x)*BYTES_PER_PIXEL, pixel);
+}
+
+static int render_atlas_scene(Scene* scene, AtlasScene* s, Atlas* a) {
+    int res = OK;
+    pthread_mutex_lock(&_read_lock);
+    _scene_file = fopen(s->path, "r");
+    if (_scene_file == NULL) {
+        pthread_mutex_unlock(&_read_lock);
+        LOG_E("Failed to open input file %s", s->path);
+        return E_FILE_OPEN;
+    }
+    res = read_scene(scene, s->width, s->height, &read_scene_line);
+    fclose(_scene_file);
+    pthread_mutex_unlock(&_read_lock);
+    if (res != OK) {
+        return res;
+    }
+    _target = s;
+    _target_atlas = a;
+    return render_region(scene, 0, 0, s->width, s->height, &write_atlas_pixel);
+}
+
+// Each thread take the next scene as soon as it is done with the previous one, in a Scene of its own
+static void* render_atlas_worker(void* arg) {
+    AtlasQueue* queue = arg;
+    Scene* scene = create_scene();
+    if (scene == NULL) {
+        LOG_E("Failed to allocate scene of a thread%s", "");
+        queue->res = E_ALLOC;
+        return NULL;
+    }
+    for (;;) {
+        size_t i = __atomic_fetch_add(&(queue->next), 1, __ATOMIC_RELAXED);
+        if (i >= queue->size) {
+            break;
+        }
+        AtlasScene* s = queue->scenes[i];
+        double scene_start = trace_now();
+        int res = render_atlas_scene(scene, s, &(queue->atlases[s->atlas]));
+        trace_span("atlas scene", i, scene_start);
+        if (res != OK) {
+            queue->res = res; // The others are still rendered, this rectangle stays black
+        }
+    }
+    destroy_scene(scene);
+    return NULL;
+}
+/* === */
+
+// Path of the atlas i, or of the index when extension is .csv
+static void atlas_path(char* path, const char* output, size_t i, const char* extension) {
+    size_t len = strlen(output);
+    if (len > 4 && strcmp(output + len - 4, ".bmp") == 0) {
+        len -= 4;
+    }
+    if (i == 0) {
+        snprintf(path, MAX_PATH, "%.*s%s", (int) len, output, extension);
+    } else {
+        snprintf(path, MAX_PATH, "%.*s_%zu%s", (int) len, output, i, extension);
+    }
+}
+
+static int write_atlas_files(AtlasScene* scenes, size_t size, Atlas* atlases, size_t count, const char* output) {
+    char path[MAX_PATH];
+    for (size_t i = 0; i < count; i++) {
+        atlas_path(path, output, i, ".bmp");
+        FILE* file = fopen(path, "wb");
+        if (file == NULL) {
+            LOG_E("Failed to open output file %s", path);
+            return E_FILE_OPEN;
+        }
+        fwrite(atlases[i].image, 1, bitmap_size(atlases[i].width, atlases[i].height), file);
+        fclose(file);
+    }
+
+    atlas_path(path, output, 0, ".csv");
+    FILE* index = fopen(path, "w");
+    if (index == NULL) {
+        LOG_E("Failed to open output file %s", path);
+        return E_FILE_OPEN;
+    }
+    fprintf(index, "scene,image,x,y,width,height\n");
+    for (size_t i = 0; i < size; i++) {
+        atlas_path(path, output, scenes[i].atlas, ".bmp");
+        fprintf(index, "%s,%s,%zu,%zu,%zu,%zu\n", scenes[i].path, path, scenes[i].x, scenes[i].y, scenes[i].width, scenes[i].height);
+    }
+    fclose(index);
+    return OK;
+}
+
+int render_atlas(const char* list, size_t default_width, size_t default_height, size_t threads, const char* output) {
+    int res = OK;
+    AtlasScene* scenes = NULL;
+    long size = read_atlas_list(list, default_width, default_height, &scenes);
+    if (size <= 0) {
+        free(scenes);
+        return (size < 0) ? size : E_ATLAS_LIST;
+    }
+
+    double pack_start = trace_now();
+    AtlasScene** order = malloc(sizeof(AtlasScene*) * size);
+    Atlas* atlases = calloc(size, sizeof(Atlas)); // At most one per scene
+    size_t count = 0;
+    if (order == NULL || atlases == NULL) {
+        res = E_ALLOC;
+    } else {
+        for (long i = 0; i < size; i++) {
+            order[i] = &(scenes[i]);
+        }
+        count = pack_atlas(order, size, atlases);
+        for (size_t i = 0; i < count && res == OK; i++) {
+            atlases[i].stride = bitmap_stride(atlases[i].width);
+            atlases[i].image = calloc(bitmap_size(atlases[i].width, atlases[i].height), 1);
+            if (atlases[i].image == NULL) {
+                LOG_E("Failed to allocate an atlas of %zux%zu", atlases[i].width, atlases[i].height);
+                res = E_ALLOC;
+            } else {
+                write_bitmap_headers(atlases[i].image, atlases[i].width, atlases[i].height);
+            }
+        }
+    }
+    trace_span("pack atlas", -1, pack_start);
+
+    if (res == OK) {
+        AtlasQueue queue = {order, size, 0, atlases, OK};
+        pthread_t* pool = malloc(sizeof(pthread_t) * threads);
+        size_t started = 0;
+        for (; pool && started < threads; started++) {
+            if (pthread_create(&(pool[started]), NULL, &render_atlas_worker, &queue) != 0) {
+                break;
+            }
+        }
+        if (started == 0) {
+            render_atlas_worker(&queue);
+        }
+        for (size_t i = 0; i < started; i++) {
+            pthread_join(pool[i], NULL);
+        }
+        free(pool);
+        res = queue.res;
+
+        double write_start = trace_now();
+        int write_res = write_atlas_files(scenes, size, atlases, count, output);
+        res = (res == OK) ? write_res : res;
+        trace_span("write", -1, write_start);
+    }
+
+    for (size_t i = 0; atlases && i < count; i++) {
+        free(atlases[i].image);
+    }
+    for (long i = 0; i < size; i++) {
+        free(scenes[i].path);
+    }
+    free(atlases);
+    free(order);
+    free(scenes);
+    return res;
+}
@@ -0,0 +1,22 @@
+/*
+    Author: Hugo Roussel, unless indicated otherwise.
+    License: MIT, with parts in CC BY-SA 4.0.
+
+    Render many small scenes, like icons, in one pass, packed in atlas BMP files.
+*/
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include "sys/types.h"
+
+#include "render.h"
+
+#define E_ATLAS_LIST -100
+#define ATLAS_MAX_SIZE 4096 // Side of an atlas, the scenes which do not fit go in the next one
+
+// Render the scenes listed in list, one per line: the instruction file, then optionally its WIDTHxHEIGHT,
+// else the default size. The atlases are written to output, then output_1.bmp, output_2.bmp... when there are several,
+// with an index of the rectangles in output with a .csv extension: scene,image,x,y,width,height, from the top left.
+extern int render_atlas(const char* list, size_t default_width, size_t default_height, size_t threads, const char* output);
+
+#endif
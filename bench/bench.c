@@ -0,0 +1,302 @@
+/*
+    Author: Hugo Roussel, unless indicated otherwise.
+    License: MIT, with parts in CC BY-SA 4.0.
+
+    End to end benchmark, on scenes generated along the axes driving the render cost:
+    geometry count and mix, Bezier degree, layer count, fusion, density and canvas size.
+
+    Each case start from the base case, and change one axis. The scene is generated in memory,
+    with a fixed seed, so runs are comparable. Results are CSV (or JSON with -j), one line per case:
+        parse_mb_s      instruction bytes parsed per second
+        ns_per_pixel    render time per canvas pixel, pixels encoded to BMP in memory
+        geoms_per_s     geoms times pixels per second, the rate of the naive renderer
+    Times are the median of the repetitions.
+
+    Build: gcc bench/bench.c render.c image.c trace.c -lm -O3 -pthread -o sdf-bench
+*/
+
+#include "stdlib.h"
+#include "stdio.h"
+#include "stdarg.h"
+#include "string.h"
+#include "time.h"
+#include "getopt.h"
+
+#include "../render.h"
+#include "../image.h"
+
+#define MAX_GEOMS_PER_LAYER 500 // As in render.c
+#define MAX_LINE 256
+
+typedef struct BenchCase {
+    const char* name;
+    int layers;
+    int shapes; // Per layer, a shape is one geom plus its control points
+    int points; // Mix of the shapes, in parts
+    int segments;
+    int beziers;
+    int degree; // Of the Beziers
+    int fusion; // 0 for min, 1 for smooth min
+    float extent; // Side of the square holding the shapes, the smaller the denser
+    float size; // Side of the square holding the control points of a shape
+    size_t width;
+    size_t height;
+} BenchCase;
+
+#define BASE(NAME) .name = NAME, .layers = 2, .shapes = 40, .points = 1, .segments = 1, .beziers = 1, .degree = 3, .fusion = 0, .extent = 1, .size = 0.1, .width = 512, .height = 512
+
+static BenchCase cases[] = {
+    {BASE("base")},
+    {BASE("shapes_10"), .shapes = 10},
+    {BASE("shapes_100"), .shapes = 100},
+    {BASE("shapes_160"), .shapes = 160},
+    {BASE("points_only"), .segments = 0, .beziers = 0},
+    {BASE("segments_only"), .points = 0, .beziers = 0},
+    {BASE("beziers_only"), .points = 0, .segments = 0},
+    {BASE("bezier_degree_2"), .points = 0, .segments = 0, .degree = 2},
+    {BASE("bezier_degree_6"), .points = 0, .segments = 0, .degree = 6},
+    {BASE("bezier_degree_10"), .points = 0, .segments = 0, .degree = 10},
+    {BASE("layers_1"), .layers = 1},
+    {BASE("layers_5"), .layers = 5},
+    {BASE("smooth_min"), .fusion = 1},
+    {BASE("smooth_min_layers_5"), .fusion = 1, .layers = 5},
+    {BASE("dense"), .extent = 0.25},
+    {BASE("large_shapes"), .size = 0.5},
+    {BASE("canvas_128"), .width = 128, .height = 128},
+    {BASE("canvas_2048"), .width = 2048, .height = 2048},
+    {BASE("canvas_wide"), .width = 2048, .height = 256},
+};
+
+/* Scene generation */
+
+static unsigned int seed = 1;
+
+// Uniform in [0, 1[, deterministic across platforms
+static float random_unit() {
+    seed = seed * 1103515245 + 12345;
+    return ((seed >> 8) & 0xFFFFFF) / (float) 0x1000000;
+}
+
+static char* text = NULL; // Instructions, one per line
+static size_t text_size = 0;
+static size_t text_capacity = 0;
+
+static void emit(const char* fmt, ...) {
+    char line[MAX_LINE];
+    va_list args;
+    va_start(args, fmt);
+    int size = vsnprintf(line, MAX_LINE, fmt, args);
+    va_end(args);
+    if (text_size + size + 1 > text_capacity) {
+        text_capacity = (text_capacity == 0) ? 1 << 16 : text_capacity * 2;
+        text = realloc(text, text_capacity);
+    }
+    memcpy(text + text_size, line, size);
+    text_size += size;
+    text[text_size] = '\0';
+}
+
+static float center_x = 0;
+static float center_y = 0;
+
+// Place the next shape
+static void move_center(BenchCase* c) {
+    center_x = 0.5 + (random_unit() - 0.5) * c->extent;
+    center_y = 0.5 + (random_unit() - 0.5) * c->extent;
+}
+
+static void emit_point(BenchCase* c, float round) {
+    float x = center_x + (random_unit() - 0.5) * c->size;
+    float y = center_y + (random_unit() - 0.5) * c->size;
+    if (round > 0) {
+        emit("ROUND(%.4f POINT(%.4f %.4f COLOR(%.3f %.3f %.3f 1)))\n", round, x, y, random_unit(), random_unit(), random_unit());
+    } else {
+        emit("POINT(%.4f %.4f)\n", x, y);
+    }
+}
+
+// Return how many geoms were generated
+static size_t generate_scene(BenchCase* c) {
+    seed = 1;
+    text_size = 0;
+    size_t geoms = 0;
+    int parts = c->points + c->segments + c->beziers;
+    for (int l = 0; l < c->layers; l++) {
+        emit("LAYER(%d)\n", c->fusion);
+        int size = 0;
+        for (int s = 0; s < c->shapes; s++) {
+            int kind = (s % parts);
+            move_center(c);
+            if (kind < c->points && size + 1 <= MAX_GEOMS_PER_LAYER) {
+                emit_point(c, 0.005 + 0.02 * random_unit());
+                size += 1;
+            } else if (kind < c->points + c->segments && size + 3 <= MAX_GEOMS_PER_LAYER) {
+                emit_point(c, 0);
+                emit_point(c, 0);
+                emit("ROUND(%.4f SEGMENT(%d %d))\n", 0.002 + 0.005 * random_unit(), size, size + 1);
+                size += 3;
+            } else if (size + c->degree + 2 <= MAX_GEOMS_PER_LAYER) {
+                for (int i = 0; i <= c->degree; i++) {
+                    emit_point(c, 0);
+                }
+                emit("ROUND(%.4f BEZIER(", 0.002 + 0.005 * random_unit());
+                for (int i = 0; i <= c->degree; i++) {
+                    emit((i < c->degree) ? "%d " : "%d))\n", size + i);
+                }
+                size += c->degree + 2;
+            }
+        }
+        geoms += size;
+    }
+    return geoms;
+}
+/* === */
+
+/* Callbacks */
+
+static size_t text_cursor = 0;
+
+static int read_text_line(char** line, size_t* len) {
+    if (text_cursor >= text_size) {
+        return 0;
+    }
+    char* end = strchr(text + text_cursor, '\n');
+    size_t size = (end ? end + 1 - text : text_size) - text_cursor;
+    if (size + 1 > *len) {
+        *len = size + 1;
+        *line = realloc(*line, *len);
+    }
+    memcpy(*line, text + text_cursor, size);
+    (*line)[size] = '\0';
+    text_cursor += size;
+    return size;
+}
+
+static unsigned char* image = NULL;
+static int image_stride = 0;
+
+static void write_image_pixel(int x, int y, float pixel[3]) {
+    encode_bitmap_pixel(image + ((size_t) y)*image_stride + x*BYTES_PER_PIXEL, pixel);
+}
+
+static void print(char* msg) {
+    fprintf(stderr, "%s", msg);
+}
+/* === */
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int compare_double(const void* a, const void* b) {
+    double da = *(double*) a;
+    double db = *(double*) b;
+    return (da > db) - (da < db);
+}
+
+static double median(double* values, int count) {
+    qsort(values, count, sizeof(double), &compare_double);
+    return (count % 2) ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+// Checksum of the image, so the render cannot be optimized away, and changes in the output are visible
+static unsigned long checksum(size_t size) {
+    unsigned long sum = 0;
+    for (size_t i = 0; i < size; i++) {
+        sum = sum * 31 + image[i];
+    }
+    return sum;
+}
+
+int main(int argc, char* argv[]) {
+    int repetitions = 5;
+    int warmup = 1;
+    int json = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:w:j")) != -1) {
+        switch (opt) {
+        case 'r':
+            repetitions = atoi(optarg);
+            break;
+        case 'w':
+            warmup = atoi(optarg);
+            break;
+        case 'j':
+            json = 1;
+            break;
+        default:
+            optind = argc + 1; // Show the usage
+            break;
+        }
+    }
+    if (optind > argc || repetitions < 1 || warmup < 0) {
+        fprintf(stderr, "Usage: %s [-r repetitions] [-w warmup] [-j] [case name filter]\n", argv[0]);
+        return -1;
+    }
+    const char* filter = (optind < argc) ? argv[optind] : "";
+
+    set_message_callback(&print);
+    Scene* scene = create_scene();
+    double* parse_times = malloc(sizeof(double) * repetitions);
+    double* render_times = malloc(sizeof(double) * repetitions);
+    int first = 1;
+    if (json) {
+        printf("[\n");
+    } else {
+        printf("name,layers,geoms,degree,fusion,extent,width,height,bytes,parse_mb_s,ns_per_pixel,geoms_per_s,checksum\n");
+    }
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(BenchCase); i++) {
+        BenchCase* c = &(cases[i]);
+        if (strstr(c->name, filter) == NULL) {
+            continue;
+        }
+        size_t geoms = generate_scene(c);
+        size_t pixels = c->width * c->height;
+        image_stride = bitmap_stride(c->width);
+        image = realloc(image, image_stride * c->height);
+
+        for (int r = -warmup; r < repetitions; r++) {
+            text_cursor = 0;
+            double start = now();
+            read_scene(scene, c->width, c->height, &read_text_line);
+            double parsed = now();
+            render_canvas(scene, c->width, c->height, &write_image_pixel);
+            double rendered = now();
+            if (r >= 0) {
+                parse_times[r] = parsed - start;
+                render_times[r] = rendered - parsed;
+            }
+        }
+
+        double parse = median(parse_times, repetitions);
+        double render = median(render_times, repetitions);
+        double parse_mb_s = text_size / parse / 1e6;
+        double ns_per_pixel = render * 1e9 / pixels;
+        double geoms_per_s = geoms * (double) pixels / render;
+        unsigned long sum = checksum(image_stride * c->height);
+        if (json) {
+            printf("%s  {\"name\": \"%s\", \"layers\": %d, \"geoms\": %zu, \"degree\": %d, \"fusion\": %d, \"extent\": %.2f, \"width\": %zu, \"height\": %zu, "
+                   "\"bytes\": %zu, \"parse_mb_s\": %.2f, \"ns_per_pixel\": %.2f, \"geoms_per_s\": %.4g, \"checksum\": \"%016lx\"}",
+                   first ? "" : ",\n", c->name, c->layers, geoms, c->degree, c->fusion, c->extent, c->width, c->height,
+                   text_size, parse_mb_s, ns_per_pixel, geoms_per_s, sum);
+        } else {
+            printf("%s,%d,%zu,%d,%d,%.2f,%zu,%zu,%zu,%.2f,%.2f,%.4g,%016lx\n", c->name, c->layers, geoms, c->degree, c->fusion, c->extent,
+                   c->width, c->height, text_size, parse_mb_s, ns_per_pixel, geoms_per_s, sum);
+        }
+        fflush(stdout);
+        first = 0;
+    }
+    if (json) {
+        printf("\n]\n");
+    }
+
+    free(parse_times);
+    free(render_times);
+    free(image);
+    free(text);
+    destroy_scene(scene);
+    return OK;
+}
@@ -0,0 +1,274 @@
+/*
+    Author: Hugo Roussel, unless indicated otherwise.
+    License: MIT, with parts in CC BY-SA 4.0.
+
+    Microbenchmarks of the distance kernels, in cycles per evaluation.
+
+    render.c is included, to reach its static kernels, and let them be inlined like in the render loop.
+    Each kernel run over the same randomized inputs, the results are summed so the work cannot be
+    optimized away, and checked against a double precision reference. The best of the trials is kept.
+    Cycles are read with rdtsc on x86 (reference cycles, at the nominal frequency), elsewhere they are not available.
+    Results are CSV, one line per kernel.
+
+    Build: gcc bench/kernels.c image.c trace.c -lm -O3 -pthread -o sdf-kernels
+*/
+
+#include "../render.c"
+#include "../image.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include "x86intrin.h"
+#define cycles() __rdtsc()
+#else
+#define cycles() 0
+#endif
+
+#define INPUTS 4096 // Small enough to stay in L1
+#define TRIAL_SECONDS 0.05
+#define TRIALS 5
+#define REFERENCE_SAMPLES 20000 // Of the Bezier curve, for the reference distance
+#define CHECKED 256 // Inputs checked against the reference
+#define POLYLINE_POINTS 33 // 4 chunks
+#define POLYGON_POINTS 64 // With a grid
+
+static Point inputs[INPUTS];
+static float values[INPUTS]; // Distances, for the smooth min
+static Geom geoms[MAX_BEZIER_POINT];
+static Bezier bez;
+static Vec2 bez_lut[MAX_BEZIER_LUT_SIZE];
+static Layer layer; // Holds the vertices of the polyline
+static volatile float sink = 0;
+
+static unsigned int seed = 1;
+
+static float random_unit() {
+    seed = seed * 1103515245 + 12345;
+    return ((seed >> 8) & 0xFFFFFF) / (float) 0x1000000;
+}
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Run BODY over all the inputs, index in i, for about TRIAL_SECONDS per trial. Print the best trial.
+// The first trial only sizes the others.
+#define MEASURE(NAME, FAILURES, BODY) { \
+    size_t rounds = 1; \
+    double best_ns = FLT_MAX; \
+    double best_cycles = FLT_MAX; \
+    for (int trial = -1; trial < TRIALS; trial++) { \
+        float sum = 0; \
+        double start = now(); \
+        unsigned long long start_cycles = cycles(); \
+        for (size_t r = 0; r < rounds; r++) { \
+            for (size_t i = 0; i < INPUTS; i++) { \
+                BODY \
+            } \
+        } \
+        unsigned long long end_cycles = cycles(); \
+        double end = now(); \
+        sink += sum; \
+        if (trial < 0) { \
+            rounds = max(1, TRIAL_SECONDS / (end - start)); \
+            continue; \
+        } \
+        best_ns = min(best_ns, (end - start) * 1e9 / (rounds * INPUTS)); \
+        best_cycles = min(best_cycles, (double) (end_cycles - start_cycles) / (rounds * INPUTS)); \
+    } \
+    printf("%s,%zu,%.2f,%.2f,%d\n", NAME, rounds * INPUTS, best_cycles, best_ns, FAILURES); \
+}
+
+static void random_inputs(float x0, float y0, float size) {
+    for (size_t i = 0; i < INPUTS; i++) {
+        inputs[i].v = (Vec2){x0 + random_unit() * size, y0 + random_unit() * size};
+        values[i] = (random_unit() - 0.5) * 4 * SMOOTH_MIN_RANGE;
+    }
+}
+
+static int relative_error(double value, double reference) {
+    return fabs(value - reference) > 1e-3 * max(1, fabs(reference));
+}
+
+/* References */
+
+static double reference_segment(Vec2 p, Vec2 a, Vec2 b) {
+    double bax = b.x - a.x, bay = b.y - a.y;
+    double pax = p.x - a.x, pay = p.y - a.y;
+    double h = (pax*bax + pay*bay) / (bax*bax + bay*bay);
+    h = clamp(h, 0, 1);
+    return hypot(pax - h*bax, pay - h*bay);
+}
+
+static double reference_bezier(Vec2 p) {
+    double best = FLT_MAX;
+    for (int s = 0; s <= REFERENCE_SAMPLES; s++) {
+        Vec2 c = bezier(((float) s) / REFERENCE_SAMPLES, &bez);
+        best = min(best, hypot(c.x - p.x, c.y - p.y));
+    }
+    return best;
+}
+
+static double reference_bbox(Bbox b, Vec2 p) {
+    double dx = max(0, max(b.bl.x - p.x, p.x - b.ur.x));
+    double dy = max(0, max(b.bl.y - p.y, p.y - b.ur.y));
+    return hypot(dx, dy);
+}
+/* === */
+
+static void bench_point() {
+    Point a = {{100, 100}, {1, 0, 0, 1}};
+    int failures = 0;
+    for (size_t i = 0; i < CHECKED; i++) {
+        failures += relative_error(sdPoint(inputs[i], a).d, hypot(inputs[i].v.x - 100, inputs[i].v.y - 100));
+    }
+    MEASURE("sdPoint", failures, sum += sdPoint(inputs[i], a).d;)
+}
+
+static void bench_segment() {
+    geoms[0].point.v = (Vec2){50, 60};
+    geoms[1].point.v = (Vec2){150, 130};
+    geoms[0].round_r = geoms[1].round_r = 2;
+    int failures = 0;
+    for (size_t i = 0; i < CHECKED; i++) {
+        failures += relative_error(sdSegment(inputs[i], &geoms[0], &geoms[1]).d, reference_segment(inputs[i].v, geoms[0].point.v, geoms[1].point.v));
+    }
+    MEASURE("sdSegment", failures, sum += sdSegment(inputs[i], &geoms[0], &geoms[1]).d;)
+}
+
+// The approximation may miss the closest part of the curve, only distances below the reference are failures
+static void bench_bezier(int degree) {
+    bez.size = degree + 1;
+    for (int i = 0; i <= degree; i++) {
+        geoms[i].point.v = (Vec2){random_unit() * 200, random_unit() * 200};
+        bez.points[i] = &geoms[i];
+    }
+    bez.lut = bez_lut;
+    bez.lut_size = _params.bezier_lut_size;
+    bez.lut_state = LUT_NONE; // Built by the first evaluation, out of the measures
+    int failures = 0;
+    for (size_t i = 0; i < CHECKED; i++) {
+        failures += sdApproximateBezier(inputs[i], &bez).d < reference_bezier(inputs[i].v) - 1e-2;
+    }
+    char name[32];
+    snprintf(name, 32, "sdApproximateBezier_%d", degree);
+    MEASURE(name, failures, sum += sdApproximateBezier(inputs[i], &bez).d;)
+}
+
+// A random walk, built by the parser to get its chunks
+static void bench_polyline() {
+    char line[16 * POLYLINE_POINTS] = "POLYLINE(";
+    Vec2 v = {100, 100};
+    for (int i = 0; i < POLYLINE_POINTS; i++) {
+        v = add2(v, (Vec2){(random_unit() - 0.5) * 40, (random_unit() - 0.5) * 40});
+        layer.geoms[i].type = POINT;
+        layer.geoms[i].point.v = v;
+        layer.geoms[i].round_r = 0;
+        snprintf(line + strlen(line), 16, (i + 1 < POLYLINE_POINTS) ? "%d " : "%d)", i);
+    }
+    layer.size = POLYLINE_POINTS;
+    size_t cursor = 0;
+    Polyline pl;
+    if (parse_polyline(&layer, line, &cursor, strlen(line), &pl) != OK) {
+        return;
+    }
+    int failures = 0;
+    for (size_t i = 0; i < CHECKED; i++) {
+        double reference = FLT_MAX;
+        for (int j = 0; j + 1 < POLYLINE_POINTS; j++) {
+            reference = min(reference, reference_segment(inputs[i].v, pl.vertices[j].point.v, pl.vertices[j+1].point.v));
+        }
+        failures += relative_error(sdPolyline(inputs[i], &pl).d, reference);
+    }
+    MEASURE("sdPolyline_32", failures, sum += sdPolyline(inputs[i], &pl).d;)
+}
+
+// A star, around the middle of the inputs
+static void bench_polygon() {
+    char line[16 * POLYGON_POINTS] = "POLYGON(";
+    layer.vertices_size = 0;
+    for (int i = 0; i < POLYGON_POINTS; i++) {
+        float r = (i % 2) ? 90 : 50;
+        layer.geoms[i].type = POINT;
+        layer.geoms[i].point.v = (Vec2){100 + r * cosf(2 * M_PI * i / POLYGON_POINTS), 100 + r * sinf(2 * M_PI * i / POLYGON_POINTS)};
+        layer.geoms[i].round_r = 0;
+        snprintf(line + strlen(line), 16, (i + 1 < POLYGON_POINTS) ? "%d " : "%d)", i);
+    }
+    layer.size = POLYGON_POINTS;
+    size_t cursor = 0;
+    Polygon pg;
+    if (parse_polygon(&layer, line, &cursor, strlen(line), &pg) != OK || pg.grid == 0) {
+        return;
+    }
+    int failures = 0;
+    for (size_t i = 0; i < CHECKED; i++) {
+        double reference = FLT_MAX;
+        for (int j = 0; j < POLYGON_POINTS; j++) {
+            reference = min(reference, reference_segment(inputs[i].v, pg.outline.vertices[j].point.v, pg.outline.vertices[j+1].point.v));
+        }
+        failures += relative_error(fabsf(sdPolygon(inputs[i], &pg).d), reference);
+    }
+    MEASURE("sdPolygon_64", failures, sum += sdPolygon(inputs[i], &pg).d;)
+}
+
+static void bench_sminq() {
+    int failures = 0;
+    for (size_t i = 0; i < CHECKED; i++) {
+        Vec2 r = sminq(values[i], values[(i + 1) % INPUTS], _params.smooth_min_factor);
+        failures += r.x > min(values[i], values[(i + 1) % INPUTS]) || r.y < 0 || r.y > 1;
+    }
+    MEASURE("sminq", failures, sum += sminq(values[i], values[(i + 1) % INPUTS], _params.smooth_min_factor).x;)
+}
+
+static void bench_smooth_min() {
+    RichDistance a = {0, {1, 0, 0, 1}};
+    RichDistance b = {0, {0, 0, 1, 1}};
+    int failures = 0;
+    for (size_t i = 0; i < CHECKED; i++) {
+        a.d = values[i];
+        b.d = values[(i + 1) % INPUTS];
+        RichDistance r = sdSmoothMin(a, b);
+        failures += r.d > min(a.d, b.d) || fabsf(r.rgba[0] + r.rgba[2] - 1) > 1e-5;
+    }
+    MEASURE("sdSmoothMin", failures, a.d = values[i]; b.d = values[(i + 1) % INPUTS]; RichDistance r = sdSmoothMin(a, b); sum += r.d + r.rgba[0];)
+}
+
+// Must never overestimate the distance, the geoms would be skipped
+static void bench_bbox() {
+    Bbox b = {{80, 90}, {120, 140}};
+    int failures = 0;
+    for (size_t i = 0; i < CHECKED; i++) {
+        float d = distanceBbox(b, inputs[i].v.x, inputs[i].v.y);
+        failures += (d > reference_bbox(b, inputs[i].v) + 1e-3) || ((d < 0) != (reference_bbox(b, inputs[i].v) == 0));
+    }
+    MEASURE("distanceBbox", failures, sum += distanceBbox(b, inputs[i].v.x, inputs[i].v.y);)
+}
+
+static void bench_pixel_writer() {
+    static unsigned char data[INPUTS * BYTES_PER_PIXEL];
+    float pixel[3] = {0.25, 0.5, 1};
+    encode_bitmap_pixel(data, pixel);
+    int failures = (data[0] != 255) || (data[1] != 127 && data[1] != 128) || (data[2] != 63 && data[2] != 64); // BGR
+    MEASURE("encode_bitmap_pixel", failures, pixel[0] = inputs[i].rgba[0]; encode_bitmap_pixel(data + i*BYTES_PER_PIXEL, pixel); sum += data[i*BYTES_PER_PIXEL];)
+}
+
+int main(int argc, char* argv[]) {
+    random_inputs(0, 0, 200);
+    for (size_t i = 0; i < INPUTS; i++) {
+        inputs[i].rgba[0] = random_unit();
+    }
+    printf("kernel,evaluations,cycles_per_eval,ns_per_eval,failures\n");
+    bench_point();
+    bench_segment();
+    for (int degree = 2; degree < MAX_BEZIER_POINT; degree++) {
+        bench_bezier(degree);
+    }
+    bench_polyline();
+    bench_polygon();
+    bench_sminq();
+    bench_smooth_min();
+    bench_bbox();
+    bench_pixel_writer();
+    return OK;
+}
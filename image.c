@@ -0,0 +1,118 @@
+/*
+    Author: Hugo Roussel, unless indicated otherwise.
+    License: MIT, with parts in CC BY-SA 4.0.
+
+    Image encoding and decoding helpers, shared by the programs using render.c.
+*/
+
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+
+#include "image.h"
+
+/* BMP metadata, taken from https://stackoverflow.com/a/47785639 CC BY-SA 4.0 */
+unsigned char* create_bitmap_file_header(int height, int stride) {
+    int fileSize = FILE_HEADER_SIZE + INFO_HEADER_SIZE + (stride * height);
+
+    static unsigned char fileHeader[] = {
+        0,0,     /// signature
+        0,0,0,0, /// image file size in bytes
+        0,0,0,0, /// reserved
+        0,0,0,0, /// start of pixel array
+    };
+
+    fileHeader[ 0] = (unsigned char)('B');
+    fileHeader[ 1] = (unsigned char)('M');
+    fileHeader[ 2] = (unsigned char)(fileSize      );
+    fileHeader[ 3] = (unsigned char)(fileSize >>  8);
+    fileHeader[ 4] = (unsigned char)(fileSize >> 16);
+    fileHeader[ 5] = (unsigned char)(fileSize >> 24);
+    fileHeader[10] = (unsigned char)(FILE_HEADER_SIZE + INFO_HEADER_SIZE);
+
+    return fileHeader;
+}
+
+unsigned char* create_bitmap_info_header(int height, int width) {
+    static unsigned char infoHeader[] = {
+        0,0,0,0, /// header size
+        0,0,0,0, /// image width
+        0,0,0,0, /// image height
+        0,0,     /// number of color planes
+        0,0,     /// bits per pixel
+        0,0,0,0, /// compression
+        0,0,0,0, /// image size
+        0,0,0,0, /// horizontal resolution
+        0,0,0,0, /// vertical resolution
+        0,0,0,0, /// colors in color table
+        0,0,0,0, /// important color count
+    };
+
+    infoHeader[ 0] = (unsigned char)(INFO_HEADER_SIZE);
+    infoHeader[ 4] = (unsigned char)(width      );
+    infoHeader[ 5] = (unsigned char)(width >>  8);
+    infoHeader[ 6] = (unsigned char)(width >> 16);
+    infoHeader[ 7] = (unsigned char)(width >> 24);
+    infoHeader[ 8] = (unsigned char)(height      );
+    infoHeader[ 9] = (unsigned char)(height >>  8);
+    infoHeader[10] = (unsigned char)(height >> 16);
+    infoHeader[11] = (unsigned char)(height >> 24);
+    infoHeader[12] = (unsigned char)(1);
+    infoHeader[14] = (unsigned char)(BYTES_PER_PIXEL*8);
+
+    return infoHeader;
+}
+/* === */
+
+int bitmap_stride(int width) {
+    int widthInBytes = width * BYTES_PER_PIXEL;
+    int paddingSize = (4 - (widthInBytes) % 4) % 4;
+    return widthInBytes + paddingSize;
+}
+
+size_t bitmap_size(int width, int height) {
+    return BITMAP_HEADER_SIZE + ((size_t) bitmap_stride(width)) * height;
+}
+
+void write_bitmap_headers(unsigned char* buffer, int width, int height) {
+    memcpy(buffer, create_bitmap_file_header(height, bitmap_stride(width)), FILE_HEADER_SIZE);
+    memcpy(buffer + FILE_HEADER_SIZE, create_bitmap_info_header(height, width), INFO_HEADER_SIZE);
+}
+
+void encode_bitmap_pixel(unsigned char* data, float pixel[3]) {
+    data[0] = (unsigned char) (pixel[2] * 255);
+    data[1] = (unsigned char) (pixel[1] * 255);
+    data[2] = (unsigned char) (pixel[0] * 255);
+}
+
+static int read_int32(unsigned char* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | (data[3] << 24);
+}
+
+unsigned char* read_bitmap_file(const char* path, int* width, int* height) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    unsigned char headers[BITMAP_HEADER_SIZE];
+    unsigned char* data = NULL;
+    if (fread(headers, 1, BITMAP_HEADER_SIZE, file) == BITMAP_HEADER_SIZE
+        && headers[0] == 'B' && headers[1] == 'M'
+        && read_int32(headers + 10) == BITMAP_HEADER_SIZE // Start of pixel array
+        && headers[FILE_HEADER_SIZE + 14] == BYTES_PER_PIXEL*8 // Bits per pixel
+        && read_int32(headers + FILE_HEADER_SIZE + 16) == 0) { // Compression
+        *width = read_int32(headers + FILE_HEADER_SIZE + 4);
+        *height = read_int32(headers + FILE_HEADER_SIZE + 8);
+        size_t size = bitmap_size(*width, *height);
+        data = (*width > 0 && *height > 0) ? malloc(size) : NULL;
+        if (data) {
+            memcpy(data, headers, BITMAP_HEADER_SIZE);
+            if (fread(data + BITMAP_HEADER_SIZE, 1, size - BITMAP_HEADER_SIZE, file) != size - BITMAP_HEADER_SIZE) {
+                free(data);
+                data = NULL;
+            }
+        }
+    }
+    fclose(file);
+    return data;
+}
@@ -0,0 +1,34 @@
+/*
+    Author: Hugo Roussel, unless indicated otherwise.
+    License: MIT, with parts in CC BY-SA 4.0.
+
+    Image encoding and decoding helpers, shared by the programs using render.c.
+*/
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "sys/types.h"
+
+/* BMP metadata, taken from https://stackoverflow.com/a/47785639 CC BY-SA 4.0 */
+#define BYTES_PER_PIXEL 3
+#define FILE_HEADER_SIZE 14
+#define INFO_HEADER_SIZE 40
+#define BITMAP_HEADER_SIZE (FILE_HEADER_SIZE + INFO_HEADER_SIZE)
+
+extern unsigned char* create_bitmap_file_header(int height, int stride);
+extern unsigned char* create_bitmap_info_header(int height, int width);
+/* === */
+
+// Size in bytes of one row of pixel, including the padding to 4 bytes
+extern int bitmap_stride(int width);
+// Size in bytes of the whole file, headers included
+extern size_t bitmap_size(int width, int height);
+// Write both headers in the first BITMAP_HEADER_SIZE bytes of buffer
+extern void write_bitmap_headers(unsigned char* buffer, int width, int height);
+// Write a RGB float pixel as BGR bytes
+extern void encode_bitmap_pixel(unsigned char* data, float pixel[3]);
+// Read a whole BMP file, as written by these helpers (24 bits, uncompressed). The pixels start at BITMAP_HEADER_SIZE.
+// Return NULL if the file cannot be read or has another format. Free the result.
+extern unsigned char* read_bitmap_file(const char* path, int* width, int* height);
+
+#endif
@@ -0,0 +1,112 @@
+/*
+    Author: Hugo Roussel, unless indicated otherwise.
+    License: MIT, with parts in CC BY-SA 4.0.
+
+    Compare two BMP renders, typically a fast mode against the reference mode (--reference).
+
+    Print the number of differing pixels, the max and mean error per channel (0 to 255),
+    and the PSNR in dB (inf for identical images). Optionally write a mask of the differing
+    pixels, brighter where the error is larger. The exit code is 1 when a pixel differs by
+    more than the threshold.
+*/
+
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include "math.h"
+#include "getopt.h"
+
+#include "render.h"
+#include "image.h"
+
+#define LOG_E(FORMAT, ...) fprintf(stderr, "%s:%d ERROR: " FORMAT "\n", __FILE__, __LINE__, __VA_ARGS__);
+
+#define E_SIZE_MISMATCH -51
+
+int main(int argc, char* argv[]) {
+    char* mask_path = NULL;
+    int threshold = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "m:t:")) != -1) {
+        switch (opt) {
+        case 'm':
+            mask_path = optarg;
+            break;
+        case 't':
+            threshold = atoi(optarg);
+            break;
+        default:
+            optind = argc; // Show the usage
+            break;
+        }
+    }
+    if (optind != argc - 2) {
+        fprintf(stderr, "Usage: %s [-m mask.bmp] [-t threshold] <image.bmp> <reference.bmp>\n", argv[0]);
+        return -1;
+    }
+
+    int width, height, ref_width, ref_height;
+    unsigned char* image = read_bitmap_file(argv[optind], &width, &height);
+    unsigned char* reference = read_bitmap_file(argv[optind + 1], &ref_width, &ref_height);
+    if (image == NULL || reference == NULL) {
+        LOG_E("Failed to read %s", (image == NULL) ? argv[optind] : argv[optind + 1]);
+        return E_FILE_OPEN;
+    }
+    if (width != ref_width || height != ref_height) {
+        LOG_E("Size mismatch, %dx%d against %dx%d", width, height, ref_width, ref_height);
+        return E_SIZE_MISMATCH;
+    }
+
+    int stride = bitmap_stride(width);
+    size_t size = bitmap_size(width, height);
+    unsigned char* mask = calloc(size, 1);
+    write_bitmap_headers(mask, width, height);
+
+    size_t differing = 0;
+    int max_error = 0;
+    double sum_error = 0;
+    double sum_squared = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            size_t offset = BITMAP_HEADER_SIZE + ((size_t) y)*stride + x*BYTES_PER_PIXEL;
+            int pixel_error = 0;
+            for (int c = 0; c < BYTES_PER_PIXEL; c++) {
+                int error = abs(image[offset + c] - reference[offset + c]);
+                pixel_error = (error > pixel_error) ? error : pixel_error;
+                sum_error += error;
+                sum_squared += error * error;
+            }
+            max_error = (pixel_error > max_error) ? pixel_error : max_error;
+            if (pixel_error > threshold) {
+                differing++;
+                // Visible even for an error of 1
+                unsigned char level = (unsigned char) ((pixel_error * 4 > 191) ? 255 : 64 + pixel_error * 4);
+                memset(mask + offset, level, BYTES_PER_PIXEL);
+            }
+        }
+    }
+
+    double values = ((double) width) * height * BYTES_PER_PIXEL;
+    double mse = sum_squared / values;
+    printf("pixels %d\ndiffering_pixels %zu\nmax_error %d\nmean_error %.4f\n", width * height, differing, max_error, sum_error / values);
+    if (mse == 0) {
+        printf("psnr inf\n");
+    } else {
+        printf("psnr %.2f\n", 10 * log10(255.0 * 255.0 / mse));
+    }
+
+    if (mask_path) {
+        FILE* file = fopen(mask_path, "wb");
+        if (file == NULL) {
+            LOG_E("Failed to open mask file %s", mask_path);
+        } else {
+            fwrite(mask, 1, size, file);
+            fclose(file);
+        }
+    }
+
+    free(mask);
+    free(image);
+    free(reference);
+    return (differing > 0) ? 1 : OK;
+}
@@ -16,82 +16,49 @@
 
 #include "stdlib.h"
 #include "stdio.h"
+#include "string.h"
+#include "getopt.h"
 
 #include "render.h"
+#include "image.h"
+#include "stripes.h"
+#include "trace.h"
+#include "perf.h"
+#include "atlas.h"
+#include "animate.h"
+#include "stream.h"
+#include "watch.h"
 
 #define LOG_E(FORMAT, ...) fprintf(stderr, "%s:%d ERROR: " FORMAT "\n", __FILE__, __LINE__, __VA_ARGS__);
 
-#define E_FILE_OPEN -50
-
 void print(char* msg) {
     fprintf(stderr, "%s", msg);
 }
 
-
-/* BMP metadata, taken from https://stackoverflow.com/a/47785639 CC BY-SA 4.0 */
-const int BYTES_PER_PIXEL = 3;
-const int FILE_HEADER_SIZE = 14;
-const int INFO_HEADER_SIZE = 40;
-
-unsigned char* create_bitmap_file_header(int height, int stride) {
-    int fileSize = FILE_HEADER_SIZE + INFO_HEADER_SIZE + (stride * height);
-
-    static unsigned char fileHeader[] = {
-        0,0,     /// signature
-        0,0,0,0, /// image file size in bytes
-        0,0,0,0, /// reserved
-        0,0,0,0, /// start of pixel array
-    };
-
-    fileHeader[ 0] = (unsigned char)('B');
-    fileHeader[ 1] = (unsigned char)('M');
-    fileHeader[ 2] = (unsigned char)(fileSize      );
-    fileHeader[ 3] = (unsigned char)(fileSize >>  8);
-    fileHeader[ 4] = (unsigned char)(fileSize >> 16);
-    fileHeader[ 5] = (unsigned char)(fileSize >> 24);
-    fileHeader[10] = (unsigned char)(FILE_HEADER_SIZE + INFO_HEADER_SIZE);
-
-    return fileHeader;
-}
-
-unsigned char* create_bitmap_info_header(int height, int width) {
-    static unsigned char infoHeader[] = {
-        0,0,0,0, /// header size
-        0,0,0,0, /// image width
-        0,0,0,0, /// image height
-        0,0,     /// number of color planes
-        0,0,     /// bits per pixel
-        0,0,0,0, /// compression
-        0,0,0,0, /// image size
-        0,0,0,0, /// horizontal resolution
-        0,0,0,0, /// vertical resolution
-        0,0,0,0, /// colors in color table
-        0,0,0,0, /// important color count
-    };
-
-    infoHeader[ 0] = (unsigned char)(INFO_HEADER_SIZE);
-    infoHeader[ 4] = (unsigned char)(width      );
-    infoHeader[ 5] = (unsigned char)(width >>  8);
-    infoHeader[ 6] = (unsigned char)(width >> 16);
-    infoHeader[ 7] = (unsigned char)(width >> 24);
-    infoHeader[ 8] = (unsigned char)(height      );
-    infoHeader[ 9] = (unsigned char)(height >>  8);
-    infoHeader[10] = (unsigned char)(height >> 16);
-    infoHeader[11] = (unsigned char)(height >> 24);
-    infoHeader[12] = (unsigned char)(1);
-    infoHeader[14] = (unsigned char)(BYTES_PER_PIXEL*8);
-
-    return infoHeader;
-}
-/* === */
-
 #define CANVAS_WIDTH 800
 #define CANVAS_HEIGHT 800
 
+size_t canvas_width = CANVAS_WIDTH;
+size_t canvas_height = CANVAS_HEIGHT;
+size_t workers = 1;
+size_t threads = 1;
+int estimate_only = 0;
+int print_stats = 0;
+int heatmap = 0;
+int reference = 0;
+size_t profile = 0; // How many of the most expensive geoms to show
+char* trace = NULL;
+char* preset = "balanced";
+float lod = 0; // Tolerance in pixels of the simplification, 0 for none
+int perf = 0;
+int atlas = 0; // The input is a list of scenes, see atlas.h
+char* frames = NULL; // Changes of the scene for each frame of an animation, see animate.h
+char* stream = NULL; // Format of the raw frames written to the output instead of BMP files, see stream.h
+int fps = 25; // Of the y4m stream
+int watch = 0; // Render again when the input changes, see watch.h
+
 FILE* imageFile = NULL;
-const int widthInBytes = CANVAS_WIDTH * BYTES_PER_PIXEL;
-const int paddingSize = (4 - (widthInBytes) % 4) % 4;
-const int stride = (widthInBytes) + paddingSize;
+int paddingSize = 0;
 
 int create_bitmap_file(char* imageFileName) {
     imageFile = fopen(imageFileName, "wb");
@@ -100,35 +67,119 @@ int create_bitmap_file(char* imageFileName) {
         return E_FILE_OPEN;
     }
 
-    unsigned char* fileHeader = create_bitmap_file_header(CANVAS_HEIGHT, stride);
-    fwrite(fileHeader, 1, FILE_HEADER_SIZE, imageFile);
-
-    unsigned char* infoHeader = create_bitmap_info_header(CANVAS_HEIGHT, CANVAS_WIDTH);
-    fwrite(infoHeader, 1, INFO_HEADER_SIZE, imageFile);
+    unsigned char headers[BITMAP_HEADER_SIZE];
+    write_bitmap_headers(headers, canvas_width, canvas_height);
+    paddingSize = bitmap_stride(canvas_width) - canvas_width*BYTES_PER_PIXEL;
+    fwrite(headers, 1, BITMAP_HEADER_SIZE, imageFile);
     return OK;
 }
 
 void write_bitmap_pixel(int x, int y, float pixel[3]) {
-    if (x >= CANVAS_WIDTH || y >= CANVAS_HEIGHT) {
+    if (x >= canvas_width || y >= canvas_height) {
         return;
     }
 
     unsigned char data[3];
-    data[0] = (unsigned char) (pixel[2] * 255);
-    data[1] = (unsigned char) (pixel[1] * 255);
-    data[2] = (unsigned char) (pixel[0] * 255);
+    encode_bitmap_pixel(data, pixel);
     fwrite(data, BYTES_PER_PIXEL, 1, imageFile);
-    if (x == CANVAS_WIDTH - 1) {
+    if (x == canvas_width - 1) {
         unsigned char padding[3] = {0, 0, 0};
         fwrite(padding, 1, paddingSize, imageFile);
     }
 }
 
+// Whole image in memory, for the renders not writing the pixels in order
+unsigned char* image = NULL;
+int imageStride = 0;
+
+void write_image_pixel(int x, int y, float pixel[3]) {
+    encode_bitmap_pixel(image + BITMAP_HEADER_SIZE + ((size_t) y)*imageStride + x*BYTES_PER_PIXEL, pixel);
+}
+
+int render_threaded(Scene* scene, char* output) {
+    int res = OK;
+    size_t size = bitmap_size(canvas_width, canvas_height);
+    image = calloc(size, 1);
+    if (image == NULL) {
+        LOG_E("Failed to allocate an image of %ld bytes", size);
+        return E_ALLOC;
+    }
+    write_bitmap_headers(image, canvas_width, canvas_height);
+    imageStride = bitmap_stride(canvas_width);
+
+    res = render_tiles(scene, canvas_width, canvas_height, threads, &write_image_pixel);
+    if (res == OK) {
+        double write_start = trace_now();
+        perf_phase(PHASE_WRITE, 1);
+        imageFile = fopen(output, "wb");
+        if (imageFile == NULL) {
+            LOG_E("Failed to open output file %s", output);
+            res = E_FILE_OPEN;
+        } else {
+            fwrite(image, 1, size, imageFile);
+            fclose(imageFile);
+        }
+        perf_phase(PHASE_WRITE, 0);
+        trace_span("write", -1, write_start);
+    }
+    free(image);
+    return res;
+}
+
+void print_estimate(Scene* scene) {
+    RenderCost cost;
+    estimate_render_cost(scene, canvas_width, canvas_height, &cost);
+    printf("points %zu\nsegments %zu\nbeziers %zu\nbezier_points %zu\ninstances %zu\npolylines %zu\npolyline_points %zu\npolygons %zu\npolygon_points %zu\nsmooth_layers %zu\n", cost.points, cost.segments, cost.beziers, cost.bezier_points, cost.instances, cost.polylines, cost.polyline_points, cost.polygons, cost.polygon_points, cost.smooth_layers);
+    printf("bbox_pixels %.0f\nband_pixels %.0f\nevaluated_pixels %.0f\nsdf_evaluations %.0f\nsmooth_min_blends %.0f\n", cost.bbox_pixels, cost.band_pixels, cost.evaluated_pixels, cost.sdf_evaluations, cost.smooth_min_blends);
+    printf("seconds %.4f\nworkers %zu\n", cost.seconds, cost.workers);
+}
+
+void print_render_stats() {
+    RenderStats stats;
+    if (get_render_stats(&stats) != OK) {
+        fprintf(stderr, "Statistics are not available, build render.c with -DRENDER_STATS\n");
+        return;
+    }
+    fprintf(stderr, "evaluated_pixels %lu\nskipped_pixels %lu\nlayer_early_outs %lu\n", stats.evaluated_pixels, stats.skipped_pixels, stats.layer_early_outs);
+    fprintf(stderr, "point_evaluations %lu\nsegment_evaluations %lu\nbezier_evaluations %lu\ninstance_evaluations %lu\npolyline_evaluations %lu\npolygon_evaluations %lu\nbbox_culls %lu\n", stats.point_evaluations, stats.segment_evaluations, stats.bezier_evaluations, stats.instance_evaluations, stats.polyline_evaluations, stats.polygon_evaluations, stats.bbox_culls);
+    fprintf(stderr, "newton_iterations %lu\nnewton_unconverged %lu\nsmooth_min_blends %lu\n", stats.newton_iterations, stats.newton_unconverged, stats.smooth_min_blends);
+}
+
 FILE* inputFile = NULL;
 int read_instruction_line(char** line, size_t* len) {
     return getline(line, len, inputFile);
 }
 
+// Show the most expensive geoms, with the instruction they come from
+void print_geom_profile(Scene* scene) {
+    GeomProfile* profiles = malloc(sizeof(GeomProfile) * profile);
+    size_t count = get_geom_profile(scene, profiles, profile);
+
+    char** lines = calloc(count, sizeof(char*));
+    char* line = NULL;
+    size_t len = 0;
+    size_t number = 0;
+    rewind(inputFile);
+    while (getline(&line, &len, inputFile) > 0) {
+        number++;
+        for (size_t i = 0; i < count; i++) {
+            if (profiles[i].line == number && lines[i] == NULL) {
+                line[strcspn(line, "\r\n")] = 0;
+                lines[i] = strdup(line);
+            }
+        }
+    }
+    free(line);
+
+    fprintf(stderr, "rank line evaluations ms instruction\n");
+    for (size_t i = 0; i < count; i++) {
+        fprintf(stderr, "%zu %zu %lu %.3f %s\n", i + 1, profiles[i].line, profiles[i].evaluations, profiles[i].ns / 1e6, lines[i] ? lines[i] : "");
+        free(lines[i]);
+    }
+    free(lines);
+    free(profiles);
+}
+
 int render_file(char* input, char* output) {
     int res = OK;
 
@@ -138,10 +189,40 @@ int render_file(char* input, char* output) {
         return E_FILE_OPEN;
     }
 
-    res = create_bitmap_file("canvas.bmp");
-    if (res == OK) {
-        read_and_render(CANVAS_WIDTH, CANVAS_HEIGHT, &read_instruction_line, &write_bitmap_pixel, &print);
-        fclose(imageFile);
+    if (!estimate_only && workers == 1 && threads == 1 && profile == 0 && lod == 0) {
+        // Stream the pixels to the file as they are rendered
+        res = create_bitmap_file(output);
+        if (res == OK) {
+            read_and_render(canvas_width, canvas_height, &read_instruction_line, &write_bitmap_pixel, &print);
+            double write_start = trace_now();
+            perf_phase(PHASE_WRITE, 1);
+            fclose(imageFile); // The pixels are written while rendering, this flushes the last ones
+            perf_phase(PHASE_WRITE, 0);
+            trace_span("write", -1, write_start);
+        }
+    } else {
+        Scene* scene = create_scene();
+        set_message_callback(&print);
+        res = read_scene(scene, canvas_width, canvas_height, &read_instruction_line);
+        if (res == OK && lod > 0) {
+            simplify_scene(scene, lod);
+        }
+        if (res == OK) {
+            if (estimate_only) {
+                print_estimate(scene);
+            } else if (workers > 1) {
+                // The workers get the scene when forked
+                perf_phase(PHASE_RENDER, 1);
+                res = render_stripes(scene, canvas_width, canvas_height, workers, output, &local_transport);
+                perf_phase(PHASE_RENDER, 0);
+            } else {
+                res = render_threaded(scene, output);
+            }
+            if (res == OK && profile > 0) {
+                print_geom_profile(scene);
+            }
+        }
+        destroy_scene(scene);
     }
 
     fclose(inputFile);
@@ -150,12 +231,164 @@ int render_file(char* input, char* output) {
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <inputFile>\n", argv[0]);
+    char* output = NULL;
+    struct option long_options[] = {
+        {"stats", no_argument, &print_stats, 1},
+        {"heatmap", no_argument, &heatmap, 1},
+        {"reference", no_argument, &reference, 1},
+        {"profile", required_argument, NULL, 'p'},
+        {"trace", required_argument, NULL, 'T'},
+        {"preset", required_argument, NULL, 'q'},
+        {"lod", required_argument, NULL, 'l'},
+        {"perf", no_argument, &perf, 1},
+        {"atlas", no_argument, &atlas, 1},
+        {"frames", required_argument, NULL, 'F'},
+        {"stream", required_argument, NULL, 'S'},
+        {"fps", required_argument, NULL, 'f'},
+        {"watch", no_argument, &watch, 1},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "eo:s:t:w:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 0:
+            break; // Flag set by getopt_long
+        case 'e':
+            estimate_only = 1;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 's':
+            if (sscanf(optarg, "%zux%zu", &canvas_width, &canvas_height) != 2 || canvas_width == 0 || canvas_height == 0) {
+                fprintf(stderr, "Bad canvas size %s, expected WIDTHxHEIGHT\n", optarg);
+                return -1;
+            }
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'w':
+            workers = atoi(optarg);
+            break;
+        case 'p':
+            profile = atoi(optarg);
+            break;
+        case 'T':
+            trace = optarg;
+            break;
+        case 'q':
+            preset = optarg;
+            break;
+        case 'l':
+            lod = atof(optarg);
+            break;
+        case 'F':
+            frames = optarg;
+            break;
+        case 'S':
+            stream = optarg;
+            break;
+        case 'f':
+            fps = atoi(optarg);
+            break;
+        default:
+            optind = argc; // Show the usage
+            break;
+        }
+    }
+    if (optind != argc - 1 || workers == 0 || threads == 0 || lod < 0 || fps <= 0) {
+        fprintf(stderr, "Usage: %s [-e] [-o output.bmp] [-s WIDTHxHEIGHT] [-t threads] [-w workers] [--preset draft|balanced|final] [--lod PIXELS] [--stats] [--heatmap] [--reference] [--profile N] [--trace trace.json] [--perf] [--atlas] [--frames frames.txt] [--stream rgb|rgba|y4m] [--fps N] [--watch] <inputFile>\n", argv[0]);
+        return -1;
+    }
+
+    if (heatmap && set_render_mode(RENDER_HEATMAP) != OK) {
+        fprintf(stderr, "The heatmap is not available, build render.c with -DRENDER_STATS\n");
         return -1;
     }
+    if (reference) {
+        set_render_mode(RENDER_REFERENCE);
+    }
+    RenderParams params;
+    if (get_render_preset(find_render_preset(preset), &params) != OK) {
+        fprintf(stderr, "Unknown preset %s, expected draft, balanced or final\n", preset);
+        return -1;
+    }
+    set_render_params(&params);
 
-    render_file(argv[1], "canvas.bmp");
+    if ((atlas || frames || stream || watch) && (workers > 1 || estimate_only || profile > 0 || lod > 0)) {
+        fprintf(stderr, "The atlas, the animations and the watch are rendered with threads only, without -w, -e, --profile or --lod\n");
+        return -1;
+    }
+    if (atlas && heatmap) {
+        // Its legend is scaled to the canvas of the last scene read, which in an atlas is any other scene's
+        fprintf(stderr, "The heatmap cannot be drawn in an atlas, render the scenes one by one\n");
+        return -1;
+    }
+    if (watch && (atlas || frames || stream)) {
+        fprintf(stderr, "The watch renders one scene to a BMP file, without --atlas, --frames or --stream\n");
+        return -1;
+    }
+    int stream_format = -1;
+    if (stream) {
+        stream_format = find_stream_format(stream);
+        if (stream_format < 0 || atlas) {
+            fprintf(stderr, "Bad stream %s, expected rgb, rgba or y4m, and no --atlas\n", stream);
+            return -1;
+        }
+    }
+    if (output == NULL) {
+        output = stream ? "-" : "canvas.bmp";
+    }
+    if (profile > 0) {
+        if (set_geom_profiling(1) != OK) {
+            fprintf(stderr, "The profile is not available, build render.c with -DRENDER_STATS\n");
+            return -1;
+        }
+        if (workers > 1) {
+            fprintf(stderr, "The profile is not collected from the workers, use threads instead\n");
+            return -1;
+        }
+    }
+
+    if (trace && trace_open(trace) != OK) {
+        return -1;
+    }
+    if (perf) {
+        if (perf_open() != OK) {
+            return -1;
+        }
+        set_phase_callback(&perf_phase);
+    }
+    double start = trace_now();
+    if (atlas) {
+        set_message_callback(&print);
+        render_atlas(argv[optind], canvas_width, canvas_height, threads, output);
+    } else if (watch) {
+        set_message_callback(&print);
+        render_watch(argv[optind], canvas_width, canvas_height, threads, output);
+    } else if (stream) {
+        set_message_callback(&print);
+        FrameStream frame_stream;
+        if (open_frame_stream(&frame_stream, output, stream_format, canvas_width, canvas_height, fps) == OK) {
+            render_animation_stream(argv[optind], frames, canvas_width, canvas_height, threads, &frame_stream);
+            close_frame_stream(&frame_stream);
+        }
+    } else if (frames) {
+        set_message_callback(&print);
+        render_animation(argv[optind], frames, canvas_width, canvas_height, threads, output);
+    } else {
+        render_file(argv[optind], output);
+    }
+    trace_span("render file", -1, start);
+    trace_close();
+    if (perf) {
+        perf_report(stderr);
+        perf_close();
+    }
+    if (print_stats) {
+        print_render_stats();
+    }
 
     exit(OK);
 }
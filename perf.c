@@ -0,0 +1,143 @@
+/*
+    Author: Hugo Roussel, unless indicated otherwise.
+    License: MIT, with parts in CC BY-SA 4.0.
+
+    Hardware performance counters of each render phase, read with Linux perf_event_open.
+
+    The counters are inherited, so the tile threads and the stripe workers are counted
+    once they exit. When the hardware has fewer counters than requested, the kernel
+    multiplexes them, and the readings are scaled by the time each counter was running.
+*/
+
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include "errno.h"
+#include "unistd.h"
+#include "sys/syscall.h"
+#include "linux/perf_event.h"
+
+#include "perf.h"
+
+#define PERF_COUNTERS 5
+
+static const char* PERF_NAMES[PERF_COUNTERS] = {"cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"};
+static const char* PHASE_NAMES[PERF_PHASES] = {"parse", "index", "render", "write"};
+
+static int _fds[PERF_COUNTERS] = {-1, -1, -1, -1, -1};
+static double _start[PERF_PHASES][PERF_COUNTERS];
+static double _total[PERF_PHASES][PERF_COUNTERS];
+static int _measured[PERF_PHASES];
+static int _open = 0;
+
+static void perf_attr(int counter, struct perf_event_attr* attr) {
+    memset(attr, 0, sizeof(struct perf_event_attr));
+    attr->size = sizeof(struct perf_event_attr);
+    attr->type = PERF_TYPE_HARDWARE;
+    switch (counter) {
+    case 0:
+        attr->config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case 1:
+        attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case 2:
+        attr->type = PERF_TYPE_HW_CACHE;
+        attr->config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case 3:
+        attr->config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    case 4:
+        attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    }
+    attr->read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr->inherit = 1;
+    attr->exclude_kernel = 1; // Allowed with the default perf_event_paranoid
+    attr->exclude_hv = 1;
+}
+
+extern int perf_open() {
+    int opened = 0;
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        perf_attr(i, &attr);
+        _fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (_fds[i] >= 0) {
+            opened++;
+        } else if (errno == EACCES || errno == EPERM) {
+            fprintf(stderr, "Not allowed to read the performance counters, see /proc/sys/kernel/perf_event_paranoid\n");
+            perf_close();
+            return E_PERF_UNAVAILABLE;
+        }
+    }
+    if (opened == 0) {
+        fprintf(stderr, "No performance counter available on this machine\n");
+        return E_PERF_UNAVAILABLE;
+    }
+    memset(_total, 0, sizeof(_total));
+    memset(_measured, 0, sizeof(_measured));
+    _open = 1;
+    return OK;
+}
+
+extern void perf_close() {
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        if (_fds[i] >= 0) {
+            close(_fds[i]);
+            _fds[i] = -1;
+        }
+    }
+    _open = 0;
+}
+
+// Estimated count since perf_open, -1 when the counter is not available
+static double perf_read(int counter) {
+    unsigned long long reading[3]; // value, time enabled, time running
+    if (_fds[counter] < 0 || read(_fds[counter], reading, sizeof(reading)) != sizeof(reading) || reading[2] == 0) {
+        return -1;
+    }
+    return (double) reading[0] * reading[1] / reading[2];
+}
+
+extern void perf_phase(int phase, int begin) {
+    if (!_open || phase < 0 || phase >= PERF_PHASES) {
+        return;
+    }
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        double value = perf_read(i);
+        if (begin) {
+            _start[phase][i] = value;
+        } else if (value >= 0 && _start[phase][i] >= 0) {
+            _total[phase][i] += value - _start[phase][i];
+        }
+    }
+    _measured[phase] = 1;
+}
+
+extern void perf_report(FILE* out) {
+    fprintf(out, "phase");
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        fprintf(out, " %s", PERF_NAMES[i]);
+    }
+    fprintf(out, " ipc\n");
+    for (int p = 0; p < PERF_PHASES; p++) {
+        if (!_measured[p]) {
+            continue;
+        }
+        fprintf(out, "%s", PHASE_NAMES[p]);
+        for (int i = 0; i < PERF_COUNTERS; i++) {
+            if (_fds[i] < 0) {
+                fprintf(out, " n/a");
+            } else {
+                fprintf(out, " %.0f", _total[p][i]);
+            }
+        }
+        if (_fds[0] >= 0 && _fds[1] >= 0 && _total[p][0] > 0) {
+            fprintf(out, " %.2f\n", _total[p][1] / _total[p][0]);
+        } else {
+            fprintf(out, " n/a\n");
+        }
+    }
+}
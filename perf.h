@@ -0,0 +1,27 @@
+/*
+    Author: Hugo Roussel, unless indicated otherwise.
+    License: MIT, with parts in CC BY-SA 4.0.
+
+    Hardware performance counters of each render phase, read with Linux perf_event_open.
+*/
+#ifndef PERF_H
+#define PERF_H
+
+#include "stdio.h"
+
+#include "render.h"
+
+#define E_PERF_UNAVAILABLE -90
+
+#define PHASE_WRITE 3 // Follows the phases of render.h
+#define PERF_PHASES 4
+
+// Open the counters, for this process and the threads and processes it starts afterward.
+// Counters unsupported by the hardware are reported as n/a, return E_PERF_UNAVAILABLE when none can be opened.
+extern int perf_open();
+extern void perf_close();
+// A CallbackPhase, accumulating the counters of each phase
+extern void perf_phase(int phase, int begin);
+extern void perf_report(FILE* out);
+
+#endif
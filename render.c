@@ -18,9 +18,13 @@
 #include "sys/types.h"
 #include "string.h"
 #include "math.h"
-#include "float.h" // FLT_MAX
+#include "float.h" // FLT_MAX, DBL_MAX
+#include "limits.h" // ULONG_MAX
+#include "pthread.h"
+#include "time.h"
 
 #include "render.h"
+#include "trace.h"
 
 #define LOG_E(FORMAT, ...) log_printf("%s:%d ERROR: " FORMAT "\n", __FILE__, __LINE__, __VA_ARGS__);
 #define END_IF_NOK(X) if ((res = X) != OK) {return res;}
@@ -38,24 +42,66 @@
 #define mix4(R, X, Y, A) R[0] = mix(X[0], Y[0], A); R[1] = mix(X[1], Y[1], A); R[2] = mix(X[2], Y[2], A); R[3] = mix(X[3], Y[3], A);
 // Copy an array[4] B into A
 #define copy4(A, B) A[0] = B[0]; A[1] = B[1]; A[2] = B[2]; A[3] = B[3];
+// Copy an array[3] B into A
+#define copy3(A, B) A[0] = B[0]; A[1] = B[1]; A[2] = B[2];
 
 #define MAX_GEOMS_PER_LAYER 500
 #define MAX_LAYER 5
-#define BEZIER_LUT_SIZE 31
+#define MAX_GROUP 4
+#define MAX_BEZIER_LUT_SIZE 63
 #define MAX_BEZIER_POINT 11
-#define BEZIER_MAX_ITERATIONS 10
-#define BEZIER_EPSILON 1e-6
-#define SMOOTH_MIN_FACTOR 1.5
+#define MAX_VERTICES_PER_LAYER 2000 // Of all the polylines of a layer
+#define MAX_LUT_PER_LAYER (MAX_GEOMS_PER_LAYER * MAX_BEZIER_LUT_SIZE) // Samples of the LUTs of the Beziers of a layer, never full
+#define POLYLINE_CHUNK 8 // Segments under one bbox of a polyline
+#define POLYGON_GRID_MIN_EDGES 32 // Below, the edges of a polygon are all scanned
+#define MAX_POLYGON_GRID 16 // Cells on each side of the edge grid of a polygon
+#define POLYGON_ROWS_PER_CELL 4 // Rows for the sign test, thinner than the cells as they hold all the edges across the polygon
+#define MAX_BUCKETS_PER_LAYER 2000 // Cells and rows of the polygon grids of a layer
+#define MAX_EDGES_PER_LAYER 20000 // Edges listed by the cells and rows of the polygon grids of a layer
+#define SMOOTH_MIN_RANGE (6*_params.smooth_min_factor) // Distance difference above which the smooth min do not blend
 
 // Global rendering parameters set at runtime
-static int _canvas_width = 0;
+static int _canvas_width = 0; // Of the scene being parsed, see set_scene_canvas
 static int _canvas_height = 0;
 static float _diag = 0;
+static size_t _line = 0; // Line being parsed
+static volatile int _cancelled = 0;
+static int _render_mode = RENDER_COLOR;
+static RenderParams _params = {31, 10, 1e-6, BEZIER_SOLVER_NEWTON, 1.5, 7.5, AA_LINEAR, 1}; // PRESET_BALANCED
+
+// Hot path counters, compiled in with -DRENDER_STATS. Counted per thread, and merged when the thread is done.
+#ifdef RENDER_STATS
+static __thread RenderStats _thread_stats;
+static RenderStats _stats;
+static pthread_mutex_t _stats_lock = PTHREAD_MUTEX_INITIALIZER;
+#define STAT(FIELD, N) (_thread_stats.FIELD += (N))
+static int _profiling = 0;
+static unsigned long _profile_overhead = 0; // Time taken by the clock itself
+#define PROFILED(G, STATEMENT) if (_profiling) { unsigned long _start = profile_clock(); STATEMENT; profile_geom(G, _start); } else { STATEMENT; }
+#else
+#define STAT(FIELD, N)
+#define PROFILED(G, STATEMENT) STATEMENT;
+#endif
 
 // Geom types
 #define POINT 0
 #define SEGMENT 1
 #define BEZIER 2
+#define CONTROL 3 // Point only referenced by other geoms, not rendered, see simplify_scene
+#define INSTANCE 4 // Placed copy of a group
+#define POLYLINE 5
+#define POLYGON 6
+
+// Domain operators, see sdDomain
+#define DOMAIN_REPEAT 0
+#define DOMAIN_MIRROR 1
+#define MAX_DOMAIN_OPS 4 // Of a geom
+#define MAX_DOMAIN_OPS_PER_LAYER 500
+
+// LUT states
+#define LUT_NONE 0
+#define LUT_BUILDING 1
+#define LUT_READY 2
 
 // Fusion types
 #define F_MIN 0
@@ -64,6 +110,11 @@ static float _diag = 0;
 typedef struct Geom Geom;
 typedef struct Segment Segment;
 typedef struct Bezier Bezier;
+typedef struct Instance Instance;
+typedef struct Polyline Polyline;
+typedef struct Polygon Polygon;
+typedef struct Vertex Vertex;
+typedef struct DomainOp DomainOp;
 typedef struct Point Point;
 typedef struct Layer Layer;
 typedef struct Scene Scene;
@@ -92,16 +143,74 @@ struct Segment {
 struct Bezier {
     Geom* points[MAX_BEZIER_POINT];
     size_t size;
-    Vec2 lut[BEZIER_LUT_SIZE]; // TODO: this is expensive as the lut exist even for non bezier geom
+    Vec2* lut; // lut_size samples, in the layer
+    int lut_size; // Set by the params when parsed
+    int lut_state; // See "LUT states", the LUT is built on first use
+};
+
+// Copy of the geoms of a group, scaled, rotated, then moved to position
+struct Instance {
+    Layer* group;
+    Vec2 position; // Of the group origin, in pixels
+    float scale;
+    float cos; // Of the rotation
+    float sin;
+};
+
+// Copy of a point of a polyline, with the radius setting its gradient, as for a segment
+struct Vertex {
+    Point point;
+    float round_r;
+};
+
+// Chain of segments, its vertices and bboxes are stored by the layer
+struct Polyline {
+    Vertex* vertices;
+    size_t size;
+    Bbox* chunks; // One for every POLYLINE_CHUNK segments
+};
+
+// Filled polygon. Its large ones have a grid of the edges crossing each cell, and each row of cells.
+struct Polygon {
+    Polyline outline; // Closed, the last vertex is the first one
+    Bbox box; // Of the vertices, covered by the grid
+    int grid; // Cells on each side, 0 without grid
+    Vec2 cell; // Size of a cell
+    float row; // Height of a row
+    int* buckets; // Start of the edges of each cell, row by row, then of each row, then the end. In the layer.
+    unsigned short* edges; // Index of the first vertex of the edges, in the layer
+};
+
+// Fold of the pixel, so that one geometry is drawn at several places
+struct DomainOp {
+    char type; // See "Domain operators"
+    Vec2 position; // REPEAT: center of the geometry, the copy 0. MIRROR: a point of the line.
+    Vec2 step; // REPEAT, between copies, 0 on an axis without copies
+    int first[2]; // REPEAT, range of copies along x and y
+    int last[2];
+    int axis; // MIRROR, 0 for a vertical line, 1 for an horizontal one
+    float side; // MIRROR, 1 when the geometry is after the line, -1 before, 0 across it
 };
 
 struct Geom {
     char type; // See "Geom types"
-    Point point;
-    Segment segment;
-    Bezier bezier;
+    int domain_size; // Next to the type, both read for every geom
+    union { // Read as type, point for a CONTROL
+        Point point;
+        Segment segment;
+        Bezier bezier;
+        Instance instance;
+        Polyline polyline;
+        Polygon polygon;
+    };
     float round_r;
     Bbox bbox;
+    size_t domain_first; // Of its operators in the layer, from the outermost one, applied first to the pixel
+    size_t line; // In the instructions, starting at 1
+#ifdef RENDER_STATS
+    unsigned long profile_evaluations;
+    unsigned long profile_ns;
+#endif
 };
 
 struct Layer {
@@ -109,11 +218,29 @@ struct Layer {
     Geom geoms[MAX_GEOMS_PER_LAYER];
     size_t size;
     Bbox bbox;
+    Vertex vertices[MAX_VERTICES_PER_LAYER]; // Of the polylines, contiguous for their evaluation loop
+    size_t vertices_size;
+    Vec2 luts[MAX_LUT_PER_LAYER]; // Of the Beziers
+    size_t luts_size;
+    DomainOp domains[MAX_DOMAIN_OPS_PER_LAYER]; // Contiguous for each geom
+    size_t domains_size;
+    Bbox chunks[MAX_VERTICES_PER_LAYER / 2]; // A polyline has less chunks than half its vertices
+    size_t chunks_size;
+    int buckets[MAX_BUCKETS_PER_LAYER]; // Of the polygons
+    size_t buckets_size;
+    unsigned short edges[MAX_EDGES_PER_LAYER];
+    size_t edges_size;
 };
 
 struct Scene {
     Layer layer[MAX_LAYER];
     size_t size;
+    Layer group[MAX_GROUP]; // Geoms placed by the instances, never rendered directly
+    size_t groups;
+    Layer* current; // Layer or group receiving the parsed geoms
+    int canvas_width; // Scale of the instruction units, for the builder and the updates
+    int canvas_height;
+    float diag;
 };
 
 struct RichDistance {
@@ -129,12 +256,23 @@ static Vec2 bezier(float t, Bezier* B);
 // ===
 
 CallbackMessage message_callback = NULL;
+CallbackPhase phase_callback = NULL;
+static inline void phase(int phase, int begin) {
+    if (phase_callback) {
+        phase_callback(phase, begin);
+    }
+}
+
 static void log_printf(const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
     char msg[512];
     vsnprintf(msg, 512, fmt, args);
-    message_callback(msg);
+    if (message_callback) {
+        message_callback(msg);
+    } else {
+        fputs(msg, stderr); // No callback set, like with the scene builder
+    }
 }
 
 static int parse_number(char* str, size_t* cursor, size_t stop, float* number) {
@@ -257,13 +395,196 @@ static int parse_bezier(Layer* layer, char* line, size_t* cursor, size_t line_si
         }
     }
 
-    for (int i = 0; i < BEZIER_LUT_SIZE; i++) {
-        bez->lut[i] = bezier(((float)i)/(BEZIER_LUT_SIZE-1), bez);
+    bez->lut_size = _params.bezier_lut_size;
+    bez->lut = &(layer->luts[layer->luts_size]);
+    layer->luts_size += bez->lut_size;
+    bez->lut_state = LUT_NONE; // Most curves of a large scene are never rendered, see use_bezier_lut
+
+    return res;
+}
+
+// Parse the N N ...) of a polyline or polygon
+// Where N is the index of a Point Geom in the Layer. The points are copied next to each other, after the vertices of the layer.
+static int parse_vertices(Layer* layer, char* line, size_t* cursor, size_t line_size, Polyline* pl) {
+    int res = OK;
+    pl->vertices = &(layer->vertices[layer->vertices_size]);
+    pl->size = 0;
+    pl->chunks = NULL;
+    while ((*cursor < line_size) && (line[*cursor - 1] != ')')) {
+        int index;
+        END_IF_NOK(parse_int(line, cursor, line_size, &index))
+        *cursor += 1; // Skip the separator space (or other next char)
+        if (layer->vertices_size + pl->size >= MAX_VERTICES_PER_LAYER) {
+            LOG_E("Reached max polyline vertex count %d", MAX_VERTICES_PER_LAYER);
+            return E_BOUND_REACHED;
+        }
+        if (index >= 0 && index < layer->size && layer->geoms[index].type == POINT) {
+            pl->vertices[pl->size].point = layer->geoms[index].point;
+            pl->vertices[pl->size].round_r = layer->geoms[index].round_r;
+            pl->size++;
+        } else {
+            LOG_E("Bad Point Geom index %d", index);
+            return E_PARSE_ISEGMENT_BAD_INDEX;
+        }
     }
 
     return res;
 }
 
+// Bboxes of the chunks of a polyline, its vertices already copied at the end of the layer ones
+static int set_polyline_chunks(Layer* layer, Polyline* pl) {
+    if (pl->size < 2) {
+        LOG_E("A polyline needs 2 points, got %zu", pl->size);
+        return E_PARSE_ISEGMENT_BAD_INDEX;
+    }
+
+    pl->chunks = &(layer->chunks[layer->chunks_size]);
+    size_t segments = pl->size - 1;
+    for (size_t c = 0; c * POLYLINE_CHUNK < segments; c++) {
+        size_t end = min((c + 1) * POLYLINE_CHUNK, segments);
+        Bbox* b = &(pl->chunks[c]);
+        b->bl = pl->vertices[c * POLYLINE_CHUNK].point.v;
+        b->ur = b->bl;
+        for (size_t i = c * POLYLINE_CHUNK + 1; i <= end; i++) {
+            b->bl.x = min(b->bl.x, pl->vertices[i].point.v.x);
+            b->bl.y = min(b->bl.y, pl->vertices[i].point.v.y);
+            b->ur.x = max(b->ur.x, pl->vertices[i].point.v.x);
+            b->ur.y = max(b->ur.y, pl->vertices[i].point.v.y);
+        }
+        layer->chunks_size++;
+    }
+    layer->vertices_size += pl->size;
+
+    return OK;
+}
+
+// Parse POLYLINE(N N ...)
+// Where N is the index of a Point Geom in the Layer
+static int parse_polyline(Layer* layer, char* line, size_t* cursor, size_t line_size, Polyline* pl) {
+    int res = OK;
+    *cursor += 9; // Skip POLYLINE(
+    END_IF_NOK(parse_vertices(layer, line, cursor, line_size, pl))
+    return set_polyline_chunks(layer, pl);
+}
+
+// Cells, and rows, of the polygon grid crossed by the bbox of the edge i
+static void polygon_edge_cells(Polygon* pg, size_t i, int* x0, int* y0, int* x1, int* y1, int* row0, int* row1) {
+    Vec2 a = pg->outline.vertices[i].point.v;
+    Vec2 b = pg->outline.vertices[i+1].point.v;
+    *x0 = clamp((int) floorf((min(a.x, b.x) - pg->box.bl.x) / pg->cell.x), 0, pg->grid - 1);
+    *y0 = clamp((int) floorf((min(a.y, b.y) - pg->box.bl.y) / pg->cell.y), 0, pg->grid - 1);
+    *x1 = clamp((int) floorf((max(a.x, b.x) - pg->box.bl.x) / pg->cell.x), 0, pg->grid - 1);
+    *y1 = clamp((int) floorf((max(a.y, b.y) - pg->box.bl.y) / pg->cell.y), 0, pg->grid - 1);
+    *row0 = clamp((int) floorf((min(a.y, b.y) - pg->box.bl.y) / pg->row), 0, pg->grid * POLYGON_ROWS_PER_CELL - 1);
+    *row1 = clamp((int) floorf((max(a.y, b.y) - pg->box.bl.y) / pg->row), 0, pg->grid * POLYGON_ROWS_PER_CELL - 1);
+}
+
+// Index the edges of a large polygon, by the cells and the rows they cross. See sdPolygon.
+// The polygon keeps no grid when it is small, or when the layer is out of room, its edges are then all scanned.
+static void set_polygon_grid(Layer* layer, Polygon* pg) {
+    size_t edges = pg->outline.size - 1;
+    int g = min(MAX_POLYGON_GRID, (int) ceilf(sqrtf(edges)));
+    int rows = g * POLYGON_ROWS_PER_CELL;
+    Vec2 size = {pg->box.ur.x - pg->box.bl.x, pg->box.ur.y - pg->box.bl.y};
+    size_t buckets = g*g + rows; // The cells, then the rows
+    pg->grid = 0;
+    pg->buckets = NULL;
+    pg->edges = NULL;
+    if (edges < POLYGON_GRID_MIN_EDGES || size.x < g || size.y < rows || layer->buckets_size + buckets + 1 > MAX_BUCKETS_PER_LAYER) {
+        return;
+    }
+    pg->grid = g;
+    pg->cell = (Vec2){size.x / g, size.y / g};
+    pg->row = size.y / rows;
+    pg->buckets = &(layer->buckets[layer->buckets_size]);
+    pg->edges = &(layer->edges[layer->edges_size]);
+
+    // Count the edges of each bucket, then turn the counts into starts
+    int x0, y0, x1, y1, row0, row1;
+    memset(pg->buckets, 0, (buckets + 1) * sizeof(int));
+    for (size_t i = 0; i < edges; i++) {
+        polygon_edge_cells(pg, i, &x0, &y0, &x1, &y1, &row0, &row1);
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                pg->buckets[y*g + x + 1]++;
+            }
+        }
+        for (int r = row0; r <= row1; r++) {
+            pg->buckets[g*g + r + 1]++;
+        }
+    }
+    for (size_t b = 1; b <= buckets; b++) {
+        pg->buckets[b] += pg->buckets[b - 1];
+    }
+    if (layer->edges_size + pg->buckets[buckets] > MAX_EDGES_PER_LAYER) {
+        pg->grid = 0;
+        return;
+    }
+
+    int next[MAX_POLYGON_GRID * MAX_POLYGON_GRID + MAX_POLYGON_GRID * POLYGON_ROWS_PER_CELL];
+    memcpy(next, pg->buckets, buckets * sizeof(int));
+    for (size_t i = 0; i < edges; i++) {
+        polygon_edge_cells(pg, i, &x0, &y0, &x1, &y1, &row0, &row1);
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                pg->edges[next[y*g + x]++] = i;
+            }
+        }
+        for (int r = row0; r <= row1; r++) {
+            pg->edges[next[g*g + r]++] = i;
+        }
+    }
+    layer->buckets_size += buckets + 1;
+    layer->edges_size += pg->buckets[buckets];
+}
+
+// Close the outline of a polygon, its vertices already copied at the end of the layer ones, then index its edges
+static int set_polygon(Layer* layer, Polygon* pg) {
+    Polyline* pl = &(pg->outline);
+    if (pl->size < 3) {
+        LOG_E("A polygon needs 3 points, got %zu", pl->size);
+        return E_PARSE_ISEGMENT_BAD_INDEX;
+    }
+    if (pl->vertices[pl->size - 1].point.v.x != pl->vertices[0].point.v.x || pl->vertices[pl->size - 1].point.v.y != pl->vertices[0].point.v.y) {
+        if (layer->vertices_size + pl->size >= MAX_VERTICES_PER_LAYER) {
+            LOG_E("Reached max polyline vertex count %d", MAX_VERTICES_PER_LAYER);
+            return E_BOUND_REACHED;
+        }
+        pl->vertices[pl->size++] = pl->vertices[0]; // Close it, the edges are the segments between the vertices
+    }
+    layer->vertices_size += pl->size;
+
+    pg->box.bl = pl->vertices[0].point.v;
+    pg->box.ur = pg->box.bl;
+    for (size_t i = 1; i < pl->size; i++) {
+        pg->box.bl.x = min(pg->box.bl.x, pl->vertices[i].point.v.x);
+        pg->box.bl.y = min(pg->box.bl.y, pl->vertices[i].point.v.y);
+        pg->box.ur.x = max(pg->box.ur.x, pl->vertices[i].point.v.x);
+        pg->box.ur.y = max(pg->box.ur.y, pl->vertices[i].point.v.y);
+    }
+    set_polygon_grid(layer, pg);
+
+    return OK;
+}
+
+// Parse POLYGON(N N N ...)
+// Where N is the index of a Point Geom in the Layer. The polygon is closed, its last point joins the first.
+static int parse_polygon(Layer* layer, char* line, size_t* cursor, size_t line_size, Polygon* pg) {
+    int res = OK;
+    Polyline* pl = &(pg->outline);
+    *cursor += 8; // Skip POLYGON(
+    END_IF_NOK(parse_vertices(layer, line, cursor, line_size, pl))
+    return set_polygon(layer, pg);
+}
+
+// Grow the bbox of the shape, to hold its rounding
+static void grow_bbox_round(Geom* g) {
+    g->bbox.bl.x -= (ceilf(g->round_r) + 1);
+    g->bbox.bl.y -= (ceilf(g->round_r) + 1);
+    g->bbox.ur.x += (ceilf(g->round_r) + 1);
+    g->bbox.ur.y += (ceilf(g->round_r) + 1);
+}
+
 // Parse ROUND(N ...)
 static int parse_round(Scene* scene, char* line, size_t* cursor, size_t line_size, Geom* geom) {
     int res = OK;
@@ -273,15 +594,129 @@ static int parse_round(Scene* scene, char* line, size_t* cursor, size_t line_siz
     END_IF_NOK(parse_line(scene, line, cursor, line_size))
     *cursor += 1; // Skip the )
     geom->round_r *= _diag;
+    grow_bbox_round(geom);
+
+    return res;
+}
+
+// Reserve the next operator of geom in the layer, before the inner ones
+static int add_domain_op(Layer* layer, Geom* geom, DomainOp** op) {
+    if (geom->domain_size >= MAX_DOMAIN_OPS) {
+        LOG_E("Reached max domain operator count %d", MAX_DOMAIN_OPS);
+        return E_BOUND_REACHED;
+    }
+    if (layer->domains_size >= MAX_DOMAIN_OPS_PER_LAYER) {
+        LOG_E("Reached max domain operator count %d for line %zu", MAX_DOMAIN_OPS_PER_LAYER, _line);
+        return E_BOUND_REACHED;
+    }
+    if (geom->domain_size == 0) {
+        geom->domain_first = layer->domains_size;
+    }
+    *op = &(layer->domains[layer->domains_size++]);
+    geom->domain_size++;
+    return OK;
+}
+
+// Parse REPEAT(DX DY NX NY ...)
+// Copies every DX DY, NX NY times. A step of 0 leaves the axis without copies, a count of 0 repeats across the whole canvas.
+static int parse_repeat(Scene* scene, char* line, size_t* cursor, size_t line_size, Geom* geom) {
+    int res = OK;
+    float count[2];
+    DomainOp* op = NULL;
+    END_IF_NOK(add_domain_op(scene->current, geom, &op))
+    op->type = DOMAIN_REPEAT;
+    *cursor += 7; // Skip REPEAT(
+    END_IF_NOK(parse_number(line, cursor, line_size, &(op->step.x)))
+    *cursor += 1; // Skip the separator space
+    END_IF_NOK(parse_number(line, cursor, line_size, &(op->step.y)))
+    *cursor += 1; // Skip the separator space
+    END_IF_NOK(parse_number(line, cursor, line_size, &(count[0])))
+    *cursor += 1; // Skip the separator space
+    END_IF_NOK(parse_number(line, cursor, line_size, &(count[1])))
+    *cursor += 1; // Skip the separator space
+    END_IF_NOK(parse_line(scene, line, cursor, line_size))
+    *cursor += 1; // Skip the )
+
+    op->step.x *= _canvas_width;
+    op->step.y *= _canvas_height;
+    op->position = (Vec2){(geom->bbox.bl.x + geom->bbox.ur.x) / 2, (geom->bbox.bl.y + geom->bbox.ur.y) / 2};
+    float step[2] = {op->step.x, op->step.y};
+    float bl[2] = {geom->bbox.bl.x, geom->bbox.bl.y};
+    float ur[2] = {geom->bbox.ur.x, geom->bbox.ur.y};
+    float size[2] = {_canvas_width, _canvas_height};
+    float margin = 2*SMOOTH_MIN_RANGE + 1; // Copies influencing the canvas, see influence_margin
+    for (int a = 0; a < 2; a++) {
+        if (step[a] != 0 && (step[a] < 1 || count[a] < 0)) {
+            LOG_E("Bad repetition, step of %f pixels, %f copies", step[a], count[a]);
+            return E_PARSE_BAD_DOMAIN;
+        }
+        if (step[a] == 0) {
+            op->first[a] = 0;
+            op->last[a] = 0;
+        } else if (count[a] >= 1) {
+            op->first[a] = 0;
+            op->last[a] = (int) count[a] - 1;
+        } else {
+            op->first[a] = (int) ceilf((-margin - ur[a]) / step[a]);
+            op->last[a] = (int) floorf((size[a] + margin - bl[a]) / step[a]);
+        }
+    }
+    geom->bbox.bl.x += op->first[0] * op->step.x;
+    geom->bbox.bl.y += op->first[1] * op->step.y;
+    geom->bbox.ur.x += op->last[0] * op->step.x;
+    geom->bbox.ur.y += op->last[1] * op->step.y;
+
+    return res;
+}
+
+// Parse MIRROR(AXIS N ...)
+// Mirror across the vertical line at x = N when AXIS is 0, or the horizontal line at y = N when AXIS is 1
+static int parse_mirror(Scene* scene, char* line, size_t* cursor, size_t line_size, Geom* geom) {
+    int res = OK;
+    float position;
+    DomainOp* op = NULL;
+    END_IF_NOK(add_domain_op(scene->current, geom, &op))
+    op->type = DOMAIN_MIRROR;
+    *cursor += 7; // Skip MIRROR(
+    END_IF_NOK(parse_int(line, cursor, line_size, &(op->axis)))
+    *cursor += 1; // Skip the separator space
+    END_IF_NOK(parse_number(line, cursor, line_size, &position))
+    *cursor += 1; // Skip the separator space
+    END_IF_NOK(parse_line(scene, line, cursor, line_size))
+    *cursor += 1; // Skip the )
 
-    geom->bbox.bl.x -= (ceilf(geom->round_r) + 1);
-    geom->bbox.bl.y -= (ceilf(geom->round_r) + 1);
-    geom->bbox.ur.x += (ceilf(geom->round_r) + 1);
-    geom->bbox.ur.y += (ceilf(geom->round_r) + 1);
+    if (op->axis != 0 && op->axis != 1) {
+        LOG_E("Bad mirror axis %d", op->axis);
+        return E_PARSE_BAD_DOMAIN;
+    }
+    // The pixels are folded to the side of the geometry, when it has one
+    if (op->axis == 0) {
+        op->position = (Vec2){position * _canvas_width, 0};
+        op->side = (geom->bbox.bl.x >= op->position.x) ? 1 : (geom->bbox.ur.x <= op->position.x) ? -1 : 0;
+        geom->bbox.bl.x = min(geom->bbox.bl.x, 2*op->position.x - geom->bbox.ur.x);
+        geom->bbox.ur.x = 2*op->position.x - geom->bbox.bl.x;
+    } else {
+        op->position = (Vec2){0, position * _canvas_height};
+        op->side = (geom->bbox.bl.y >= op->position.y) ? 1 : (geom->bbox.ur.y <= op->position.y) ? -1 : 0;
+        geom->bbox.bl.y = min(geom->bbox.bl.y, 2*op->position.y - geom->bbox.ur.y);
+        geom->bbox.ur.y = 2*op->position.y - geom->bbox.bl.y;
+    }
 
     return res;
 }
 
+// Empty the layer and its pools, for the geoms that follow
+static void reset_layer(Layer* layer, int fusion) {
+    layer->fusion = fusion;
+    layer->size = 0;
+    layer->vertices_size = 0;
+    layer->luts_size = 0;
+    layer->domains_size = 0;
+    layer->chunks_size = 0;
+    layer->buckets_size = 0;
+    layer->edges_size = 0;
+}
+
 // Parse LAYER(N)
 // Where N can be any of "Fusion types"
 static int parse_layer(Scene* scene, char* line, size_t* cursor, size_t line_size) {
@@ -292,8 +727,66 @@ static int parse_layer(Scene* scene, char* line, size_t* cursor, size_t line_siz
     *cursor += 1; // Skip the )
 
     scene->size += 1;
-    scene->layer[scene->size - 1].fusion = fusion;
-    scene->layer[scene->size - 1].size = 0;
+    reset_layer(&(scene->layer[scene->size - 1]), fusion);
+    scene->current = &(scene->layer[scene->size - 1]);
+
+    return res;
+}
+
+// Parse GROUP(N)
+// Where N can be any of "Fusion types". The next geoms go in the group, until the next LAYER or GROUP.
+static int parse_group(Scene* scene, char* line, size_t* cursor, size_t line_size) {
+    int res = OK;
+    int fusion;
+    *cursor += 6; // Skip GROUP(
+    END_IF_NOK(parse_int(line, cursor, line_size, &fusion))
+    *cursor += 1; // Skip the )
+
+    scene->groups += 1;
+    reset_layer(&(scene->group[scene->groups - 1]), fusion);
+    scene->current = &(scene->group[scene->groups - 1]);
+
+    return res;
+}
+
+// Parse INSTANCE(G X Y SCALE ANGLE)
+// Where G is the index of a group defined before, X Y the position of its origin, SCALE and ANGLE (in degrees) are optional
+static int parse_instance(Scene* scene, Layer* layer, char* line, size_t* cursor, size_t line_size, Instance* instance) {
+    int res = OK;
+    int index;
+    float scale = 1;
+    float angle = 0;
+    *cursor += 9; // Skip INSTANCE(
+    END_IF_NOK(parse_int(line, cursor, line_size, &index))
+    *cursor += 1; // Skip the separator space
+    END_IF_NOK(parse_number(line, cursor, line_size, &(instance->position.x)))
+    *cursor += 1; // Skip the separator space
+    END_IF_NOK(parse_number(line, cursor, line_size, &(instance->position.y)))
+    *cursor += 1; // Skip the separator space, or the )
+    if (line[*cursor - 1] != ')') {
+        END_IF_NOK(parse_number(line, cursor, line_size, &scale))
+        *cursor += 1; // Skip the separator space, or the )
+    }
+    if (line[*cursor - 1] != ')') {
+        END_IF_NOK(parse_number(line, cursor, line_size, &angle))
+        *cursor += 1; // Skip the )
+    }
+
+    // The group being parsed is the last one, it cannot be placed in itself
+    if (index < 0 || index >= scene->groups || &(scene->group[index]) == layer) {
+        LOG_E("Bad group index %d", index);
+        return E_PARSE_BAD_GROUP;
+    }
+    if (scale <= 0) {
+        LOG_E("Bad instance scale %f", scale);
+        return E_PARSE_NUMBER;
+    }
+    instance->group = &(scene->group[index]);
+    instance->position.x *= _canvas_width;
+    instance->position.y *= _canvas_height;
+    instance->scale = scale;
+    instance->cos = cosf(angle * M_PI / 180);
+    instance->sin = sinf(angle * M_PI / 180);
 
     return res;
 }
@@ -321,6 +814,56 @@ static void set_bbox_bezier(Geom* g) {
     }
 }
 
+static void set_bbox_polyline(Geom* g) {
+    g->bbox = g->polyline.chunks[0];
+    for (size_t c = 1; c * POLYLINE_CHUNK < g->polyline.size - 1; c++) {
+        g->bbox.bl.x = min(g->bbox.bl.x, g->polyline.chunks[c].bl.x);
+        g->bbox.bl.y = min(g->bbox.bl.y, g->polyline.chunks[c].bl.y);
+        g->bbox.ur.x = max(g->bbox.ur.x, g->polyline.chunks[c].ur.x);
+        g->bbox.ur.y = max(g->bbox.ur.y, g->polyline.chunks[c].ur.y);
+    }
+}
+
+// Bbox of the group bbox corners, placed by the instance
+static void set_bbox_instance(Geom* g) {
+    Instance* in = &(g->instance);
+    Bbox b = in->group->bbox;
+    if (in->group->size == 0) {
+        g->bbox = b; // Empty
+        return;
+    }
+    Vec2 corners[4] = {b.bl, {b.ur.x, b.bl.y}, b.ur, {b.bl.x, b.ur.y}};
+    for (int i = 0; i < 4; i++) {
+        Vec2 c = corners[i];
+        Vec2 v = {in->position.x + in->scale * (in->cos*c.x - in->sin*c.y), in->position.y + in->scale * (in->sin*c.x + in->cos*c.y)};
+        if (i == 0) {
+            g->bbox.bl = v;
+            g->bbox.ur = v;
+        }
+        g->bbox.bl.x = min(g->bbox.bl.x, v.x);
+        g->bbox.bl.y = min(g->bbox.bl.y, v.y);
+        g->bbox.ur.x = max(g->bbox.ur.x, v.x);
+        g->bbox.ur.y = max(g->bbox.ur.y, v.y);
+    }
+}
+
+static void set_bbox_layer(Layer* l) {
+    if (l->size == 0) {
+        // Empty bbox, so that every pixel is far away from it
+        l->bbox.bl = (Vec2){FLT_MAX, FLT_MAX};
+        l->bbox.ur = (Vec2){-FLT_MAX, -FLT_MAX};
+        return;
+    }
+    l->bbox = l->geoms[0].bbox;
+    for (size_t j = 1; j < l->size; j++) {
+        Bbox b = l->geoms[j].bbox;
+        l->bbox.bl.x = min(l->bbox.bl.x, b.bl.x);
+        l->bbox.bl.y = min(l->bbox.bl.y, b.bl.y);
+        l->bbox.ur.x = max(l->bbox.ur.x, b.ur.x);
+        l->bbox.ur.y = max(l->bbox.ur.y, b.ur.y);
+    }
+}
+
 static int parse_line(Scene* scene, char* line, size_t* cursor, size_t line_size) {
     int res = 0;
     char wkt_type[32];
@@ -330,27 +873,53 @@ static int parse_line(Scene* scene, char* line, size_t* cursor, size_t line_size
     }
     wkt_type[wkt_type_size] = '\0';
 
-    if (strcmp(wkt_type, "LAYER") == 0) {
-        if (scene->size >= MAX_LAYER) {
+    if (strcmp(wkt_type, "LAYER") == 0 || strcmp(wkt_type, "GROUP") == 0) {
+        if (scene->current != NULL) {
+            set_bbox_layer(scene->current); // Complete, the instances of a group need its bbox
+        }
+        if (wkt_type[0] == 'L' && scene->size >= MAX_LAYER) {
             LOG_E("Reached max layer count %d", MAX_LAYER);
             return E_BOUND_REACHED;
         }
-        END_IF_NOK(parse_layer(scene, line, cursor, line_size))
+        if (wkt_type[0] == 'G' && scene->groups >= MAX_GROUP) {
+            LOG_E("Reached max group count %d", MAX_GROUP);
+            return E_BOUND_REACHED;
+        }
+        if (wkt_type[0] == 'L') {
+            END_IF_NOK(parse_layer(scene, line, cursor, line_size))
+        } else {
+            END_IF_NOK(parse_group(scene, line, cursor, line_size))
+        }
         return OK;
     }
 
-    if (scene->size == 0) {
+    if (scene->current == NULL) {
         LOG_E("Trying to create geometries without layer, your first instruction should be a LAYER, got %s", line);
         return E_PARSE_NEED_LAYER;
     }
 
-    Layer* layer = &(scene->layer[scene->size-1]);
+    Layer* layer = scene->current;
     if (layer->size >= MAX_GEOMS_PER_LAYER) {
-        LOG_E("Reached max geom count %d for layer %ld", MAX_GEOMS_PER_LAYER, scene->size-1);
+        LOG_E("Reached max geom count %d for line %zu", MAX_GEOMS_PER_LAYER, _line);
         return E_BOUND_REACHED;
     }
+    if (*cursor == 0) {
+        // Start of a new geom, operations like ROUND fill it before the geometry
+        Geom* g = &(layer->geoms[layer->size]);
+        g->round_r = 0;
+        g->domain_size = 0;
+        g->line = _line;
+#ifdef RENDER_STATS
+        g->profile_evaluations = 0;
+        g->profile_ns = 0;
+#endif
+    }
     if (strcmp(wkt_type, "ROUND") == 0) {
         END_IF_NOK(parse_round(scene, line, cursor, line_size, &(layer->geoms[layer->size])))
+    } else if (strcmp(wkt_type, "REPEAT") == 0) {
+        END_IF_NOK(parse_repeat(scene, line, cursor, line_size, &(layer->geoms[layer->size])))
+    } else if (strcmp(wkt_type, "MIRROR") == 0) {
+        END_IF_NOK(parse_mirror(scene, line, cursor, line_size, &(layer->geoms[layer->size])))
     } else if (strcmp(wkt_type, "POINT") == 0) {
         layer->geoms[layer->size].type = POINT;
         END_IF_NOK(parse_point(line, cursor, line_size, &(layer->geoms[layer->size].point)))
@@ -366,6 +935,21 @@ static int parse_line(Scene* scene, char* line, size_t* cursor, size_t line_size
         END_IF_NOK(parse_bezier(layer, line, cursor, line_size, &(layer->geoms[layer->size].bezier)))
         set_bbox_bezier(&(layer->geoms[layer->size]));
         layer->size += 1;
+    } else if (strcmp(wkt_type, "POLYLINE") == 0) {
+        layer->geoms[layer->size].type = POLYLINE;
+        END_IF_NOK(parse_polyline(layer, line, cursor, line_size, &(layer->geoms[layer->size].polyline)))
+        set_bbox_polyline(&(layer->geoms[layer->size]));
+        layer->size += 1;
+    } else if (strcmp(wkt_type, "POLYGON") == 0) {
+        layer->geoms[layer->size].type = POLYGON;
+        END_IF_NOK(parse_polygon(layer, line, cursor, line_size, &(layer->geoms[layer->size].polygon)))
+        layer->geoms[layer->size].bbox = layer->geoms[layer->size].polygon.box;
+        layer->size += 1;
+    } else if (strcmp(wkt_type, "INSTANCE") == 0) {
+        layer->geoms[layer->size].type = INSTANCE;
+        END_IF_NOK(parse_instance(scene, layer, line, cursor, line_size, &(layer->geoms[layer->size].instance)))
+        set_bbox_instance(&(layer->geoms[layer->size]));
+        layer->size += 1;
     } else {
         LOG_E("Unsuported word %s in line %s", wkt_type, line);
         return E_PARSE_UNSUPPORTED;
@@ -374,6 +958,24 @@ static int parse_line(Scene* scene, char* line, size_t* cursor, size_t line_size
     return res;
 }
 
+/* Per geom profiling, see set_geom_profiling */
+#ifdef RENDER_STATS
+static inline unsigned long profile_clock() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000UL + t.tv_nsec;
+}
+
+// Account one evaluation of the geom, started at start. The geoms are shared by the threads.
+static inline void profile_geom(Geom* g, unsigned long start) {
+    unsigned long elapsed = profile_clock() - start;
+    elapsed = (elapsed > _profile_overhead) ? elapsed - _profile_overhead : 0;
+    __atomic_fetch_add(&(g->profile_evaluations), 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(g->profile_ns), elapsed, __ATOMIC_RELAXED);
+}
+#endif
+/* === */
+
 /* Signed Distance Functions */
 
 static inline float sign(float s) {
@@ -417,6 +1019,14 @@ static float squaredDistance2(Vec2 a, Vec2 b) {
     return dot2(diff, diff);
 }
 
+// Distance from p to the segment AB
+static float distanceSegment2(Vec2 p, Vec2 a, Vec2 b) {
+    Vec2 pa = sub2(p, a);
+    Vec2 ba = sub2(b, a);
+    float h = clamp(dot2(pa,ba)/dot2(ba,ba), 0.0, 1.0);
+    return length2(sub2(pa, mul2(ba, h)));
+}
+
 static inline Vec2 lerp2(Vec2 a, Vec2 b, float t) {
     return (Vec2){mix(a.x, b.x, t), mix(a.y, b.y, t)};
 }
@@ -424,7 +1034,7 @@ static inline Vec2 lerp2(Vec2 a, Vec2 b, float t) {
 // Smooth min using the quadratic method. Return the distance and a color mixing value
 static Vec2 sminq( float a, float b, float k )
 {
-    float h = 1.0 - min( fabsf(a-b)/(6.0*k), 1.0 );
+    float h = 1.0 - min( fabsf(a-b)/(6.0*k), 1.0 ); // See SMOOTH_MIN_RANGE
     float w = h*h*h;
     float m = w*0.5;
     float s = w*k;
@@ -437,8 +1047,9 @@ static inline RichDistance sdMin(RichDistance a, RichDistance b) {
     return a.d < b.d ? a : b;
 }
 
-static RichDistance sdSmoothMin(RichDistance a, RichDistance b) {
-    Vec2 sd = sminq(a.d, b.d, SMOOTH_MIN_FACTOR);
+// Always inlined, it is in the loop of sdLayer, for every geom of a smooth layer
+static inline __attribute__((always_inline)) RichDistance sdSmoothMin(RichDistance a, RichDistance b) {
+    Vec2 sd = sminq(a.d, b.d, _params.smooth_min_factor);
     RichDistance rd;
     rd.d = sd.x;
     mix4(rd.rgba, a.rgba, b.rgba, sd.y);
@@ -479,6 +1090,152 @@ static RichDistance sdSegment(Point p, Geom* ag, Geom* bg ) {
     return rd;
 }
 
+// Chebyshev distance to the bbox, a lower bound of the distance to anything inside. -1 when inside.
+float distanceBbox(Bbox bbox, float x, float y) {
+    float dx = max(bbox.bl.x - x, x - bbox.ur.x);
+    float dy = max(bbox.bl.y - y, y - bbox.ur.y);
+    if (dx < 0 && dy < 0) {
+        return -1;
+    }
+    return max(dx, dy);
+}
+
+// Squared distance to the segment from the vertex i to the next one, as sdSegment
+static inline float sdEdge2(Vec2 p, Vertex* v, size_t i) {
+    Vec2 pa = sub2(p, v[i].point.v);
+    Vec2 ba = sub2(v[i+1].point.v, v[i].point.v);
+    float h = clamp(dot2(pa,ba)/dot2(ba,ba), 0.0f, 1.0f);
+    Vec2 e = sub2(pa, mul2(ba, h));
+    return dot2(e, e);
+}
+
+// Color of the segment from the vertex i to the next one, as sdSegment
+static void edgeColor(Vec2 p, Vertex* v, size_t i, float rgba[4]) {
+    Vertex* a = &(v[i]);
+    Vertex* b = &(v[i + 1]);
+    Vec2 ba = sub2(b->point.v, a->point.v);
+    float h = clamp(dot2(sub2(p, a->point.v),ba)/dot2(ba,ba), 0.0f, 1.0f);
+    float dab = length2(ba);
+    float ar = a->round_r / dab;
+    float br = b->round_r / dab;
+    float ch = clamp(h-ar, 0.0, (1-(ar+br))) / (1 - (ar+br));
+    mix4(rgba, a->point.rgba, b->point.rgba, ch);
+}
+
+// Distance to the closest segment of a polyline, with its color as sdSegment.
+// The chunks farther than the closest segment found so far are skipped, and the color is only computed once.
+static RichDistance sdPolyline(Point p, Polyline* pl) {
+    Vertex* v = pl->vertices;
+    size_t segments = pl->size - 1;
+    float best = FLT_MAX; // Squared distance
+    size_t best_i = 0;
+    for (size_t c = 0; c * POLYLINE_CHUNK < segments; c++) {
+        float dbb = distanceBbox(pl->chunks[c], p.v.x, p.v.y);
+        if (dbb > 0 && dbb*dbb > best) {
+            continue;
+        }
+        size_t end = min((c + 1) * POLYLINE_CHUNK, segments);
+        STAT(segment_evaluations, end - c * POLYLINE_CHUNK);
+        for (size_t i = c * POLYLINE_CHUNK; i < end; i++) {
+            float d = sdEdge2(p.v, v, i);
+            best_i = (d <= best) ? i : best_i; // The last one on ties, as separate segments
+            best = min(d, best);
+        }
+    }
+
+    RichDistance rd;
+    rd.d = sqrtf(best);
+    edgeColor(p.v, v, best_i, rd.rgba);
+    return rd;
+}
+
+// Whether the edge from the vertex i crosses the horizontal line from p to the right.
+// An odd count of crossings means p is inside, from https://iquilezles.org/articles/distfunctions2d/
+static inline int crossesEdge(Vec2 p, Vertex* v, size_t i) {
+    Vec2 a = v[i].point.v;
+    Vec2 e = sub2(v[i+1].point.v, a);
+    Vec2 w = sub2(p, a);
+    int c0 = p.y >= a.y;
+    int c1 = p.y < v[i+1].point.v.y;
+    int c2 = e.x*w.y > e.y*w.x;
+    return (c0 && c1 && c2) || (!c0 && !c1 && !c2);
+}
+
+// Signed distance to a polygon, negative inside, with the color of its closest edge.
+// Without grid, every edge is scanned. With it, the sign comes from the edges of the row of p,
+// and the distance from the cells around p, in rings, until the next ring is farther than the closest edge found.
+static RichDistance sdPolygon(Point p, Polygon* pg) {
+    Vertex* v = pg->outline.vertices;
+    size_t edges = pg->outline.size - 1;
+    float best = FLT_MAX; // Squared distance
+    size_t best_i = 0;
+    int inside = 0;
+    if (pg->grid == 0) {
+        STAT(segment_evaluations, edges);
+        for (size_t i = 0; i < edges; i++) {
+            float d = sdEdge2(p.v, v, i);
+            best_i = (d < best) ? i : best_i;
+            best = min(d, best);
+            inside ^= crossesEdge(p.v, v, i);
+        }
+    } else {
+        int g = pg->grid;
+        float fx = (p.v.x - pg->box.bl.x) / pg->cell.x;
+        float fy = (p.v.y - pg->box.bl.y) / pg->cell.y;
+        float frow = (p.v.y - pg->box.bl.y) / pg->row;
+        if (frow >= 0 && frow < g * POLYGON_ROWS_PER_CELL && fx >= 0 && fx < g) {
+            int row = g*g + (int) frow;
+            STAT(segment_evaluations, pg->buckets[row + 1] - pg->buckets[row]);
+            for (int k = pg->buckets[row]; k < pg->buckets[row + 1]; k++) {
+                inside ^= crossesEdge(p.v, v, pg->edges[k]);
+            }
+        }
+        int cx = clamp((int) floorf(fx), 0, g - 1);
+        int cy = clamp((int) floorf(fy), 0, g - 1);
+        for (int r = 0; r < g; r++) {
+            // The edges not found yet are out of the square of the previous rings, the sides on the grid border do not count
+            float bound = FLT_MAX;
+            if (r > 0) {
+                if (cx - r + 1 > 0) {
+                    bound = min(bound, p.v.x - (pg->box.bl.x + (cx - r + 1) * pg->cell.x));
+                }
+                if (cx + r - 1 < g - 1) {
+                    bound = min(bound, pg->box.bl.x + (cx + r) * pg->cell.x - p.v.x);
+                }
+                if (cy - r + 1 > 0) {
+                    bound = min(bound, p.v.y - (pg->box.bl.y + (cy - r + 1) * pg->cell.y));
+                }
+                if (cy + r - 1 < g - 1) {
+                    bound = min(bound, pg->box.bl.y + (cy + r) * pg->cell.y - p.v.y);
+                }
+                if (best <= bound*bound || bound == FLT_MAX) {
+                    break;
+                }
+            }
+            for (int y = max(cy - r, 0); y <= min(cy + r, g - 1); y++) {
+                int dx = (y == cy - r || y == cy + r) ? 1 : 2*r; // All the row, or its two ends
+                for (int x = cx - r; x <= cx + r; x += dx) {
+                    if (x < 0 || x >= g) {
+                        continue;
+                    }
+                    int cell = y*g + x;
+                    STAT(segment_evaluations, pg->buckets[cell + 1] - pg->buckets[cell]);
+                    for (int k = pg->buckets[cell]; k < pg->buckets[cell + 1]; k++) {
+                        float d = sdEdge2(p.v, v, pg->edges[k]);
+                        best_i = (d < best) ? pg->edges[k] : best_i;
+                        best = min(d, best);
+                    }
+                }
+            }
+        }
+    }
+
+    RichDistance rd;
+    rd.d = inside ? -sqrtf(best) : sqrtf(best);
+    edgeColor(p.v, v, best_i, rd.rgba);
+    return rd;
+}
+
 // Bezier using De Casteljau's algorithm
 static Vec2 bezier(float t, Bezier* B) {
     Vec2 temp[MAX_BEZIER_POINT];
@@ -496,6 +1253,29 @@ static Vec2 bezier(float t, Bezier* B) {
     return temp[0];
 }
 
+// Samples of the curve, for the starting point of the distance
+static void set_bezier_lut(Bezier* bez) {
+    for (int i = 0; i < bez->lut_size; i++) {
+        bez->lut[i] = bezier(((float)i)/(bez->lut_size-1), bez);
+    }
+}
+
+// Build the LUT on its first use, once, even when several threads render the curve
+static inline void use_bezier_lut(Bezier* bez) {
+    if (__atomic_load_n(&(bez->lut_state), __ATOMIC_ACQUIRE) == LUT_READY) {
+        return;
+    }
+    int expected = LUT_NONE;
+    if (__atomic_compare_exchange_n(&(bez->lut_state), &expected, LUT_BUILDING, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        set_bezier_lut(bez);
+        __atomic_store_n(&(bez->lut_state), LUT_READY, __ATOMIC_RELEASE);
+        return;
+    }
+    while (__atomic_load_n(&(bez->lut_state), __ATOMIC_ACQUIRE) != LUT_READY) {
+        // Another thread is building it, for a few microseconds
+    }
+}
+
 // Derivative of the Bezier curve
 static Vec2 bezier_derivative(float t, Bezier* B) {
     Vec2 temp[MAX_BEZIER_POINT - 1];
@@ -515,11 +1295,23 @@ static Vec2 bezier_derivative(float t, Bezier* B) {
 }
 
 static RichDistance sdApproximateBezier(Point pos, Bezier* bez) {
+    RichDistance rd;
+    copy4(rd.rgba, bez->points[0]->point.rgba);
+    use_bezier_lut(bez);
+    if (_params.bezier_solver == BEZIER_SOLVER_POLYLINE) {
+        // Distance to the polyline through the samples
+        rd.d = FLT_MAX;
+        for (int i = 1; i < bez->lut_size; i++) {
+            rd.d = min(rd.d, distanceSegment2(pos.v, bez->lut[i-1], bez->lut[i]));
+        }
+        return rd;
+    }
+
     float min_distance_sq = FLT_MAX;
 
     // Initial subdivision to find a good starting point
     int min_i = 0;
-    for (int i = 0; i < BEZIER_LUT_SIZE; i++) {
+    for (int i = 0; i < bez->lut_size; i++) {
         float distance_sq = squaredDistance2(bez->lut[i], pos.v);
         
         if (distance_sq < min_distance_sq) {
@@ -527,10 +1319,11 @@ static RichDistance sdApproximateBezier(Point pos, Bezier* bez) {
             min_i = i;
         }
     }
-    float min_t = ((float)min_i)/(BEZIER_LUT_SIZE-1);
+    float min_t = ((float)min_i)/(bez->lut_size-1);
 
     // Refine using Newton's method
-    for (int i = 0; i < BEZIER_MAX_ITERATIONS; i++) {
+    int i = 0;
+    for (i = 0; i < _params.bezier_max_iterations; i++) {
         Vec2 point = bezier(min_t, bez);
         Vec2 derivative = bezier_derivative(min_t, bez);
         Vec2 diff = sub2(point, pos.v);
@@ -538,7 +1331,7 @@ static RichDistance sdApproximateBezier(Point pos, Bezier* bez) {
         float numerator = dot2(diff, derivative);
         float denominator = dot2(derivative, derivative);
         
-        if (fabsf(numerator) < BEZIER_EPSILON * denominator) {
+        if (fabsf(numerator) < _params.bezier_epsilon * denominator) {
             break;  // We've converged
         }
         
@@ -554,86 +1347,226 @@ static RichDistance sdApproximateBezier(Point pos, Bezier* bez) {
         
         min_t = t_new;
     }
+    STAT(newton_iterations, i);
+    STAT(newton_unconverged, i == _params.bezier_max_iterations);
 
     Vec2 closest_point = bezier(min_t, bez);
-    float d = distance2(closest_point, pos.v);
-    
-    RichDistance rd;
-    rd.d = d;
-    copy4(rd.rgba, bez->points[0]->point.rgba);
+    rd.d = distance2(closest_point, pos.v);
     return rd;
 }
 
-float distanceBbox(Bbox bbox, float x, float y) {
-    if (x < bbox.bl.x) {
-        return (bbox.bl.x - x);
+static RichDistance sdInstance(Point p, Instance* instance, float scale, float margin);
+
+// Distance to the geometry of a geom, rounded, without its domain operators.
+// sdLayer has its own copy of the switch, for the geoms without operators.
+static inline RichDistance sdShape(Point p, Geom* g, float scale, float margin) {
+    RichDistance gd = DEFAULT_RD;
+    switch (g->type)
+    {
+    case POINT:
+        STAT(point_evaluations, 1);
+        gd = opRound(sdPoint(p, g->point), g->round_r);
+        break;
+    case SEGMENT:
+        STAT(segment_evaluations, 1);
+        gd = opRound(sdSegment(p, g->segment.a, g->segment.b), g->round_r);
+        break;
+    case BEZIER:
+        STAT(bezier_evaluations, 1);
+        gd = opRound(sdApproximateBezier(p, &(g->bezier)), g->round_r);
+        break;
+    case INSTANCE:
+        STAT(instance_evaluations, 1);
+        gd = opRound(sdInstance(p, &(g->instance), scale, margin + g->round_r*scale), g->round_r);
+        break;
+    case POLYLINE:
+        STAT(polyline_evaluations, 1);
+        gd = opRound(sdPolyline(p, &(g->polyline)), g->round_r);
+        break;
+    case POLYGON:
+        STAT(polygon_evaluations, 1);
+        gd = opRound(sdPolygon(p, &(g->polygon)), g->round_r);
+        break;
+    default:
+        break;
+    }
+    return gd;
+}
+
+// Distance to a geom, with p folded by its domain operators from depth.
+// MIRROR moves p to the side of the geometry, or evaluates p and its reflection when the geometry crosses the line.
+// REPEAT moves p to the two closest copies on each axis,
+// exact as long as the geometry fits in a step. The copies of a geom never blend with each other.
+static RichDistance sdDomain(Layer* layer, Point p, Geom* g, int depth, float scale, float margin) {
+    if (depth == g->domain_size) {
+        return sdShape(p, g, scale, margin);
     }
-    if (y < bbox.bl.y) {
-        return (bbox.bl.y - y);
+    DomainOp* op = &(layer->domains[g->domain_first + depth]);
+    if (op->type == DOMAIN_MIRROR) {
+        if (op->side == 0) {
+            Point reflection = p;
+            if (op->axis == 0) {
+                reflection.v.x = 2*op->position.x - p.v.x;
+            } else {
+                reflection.v.y = 2*op->position.y - p.v.y;
+            }
+            return sdMin(sdDomain(layer, p, g, depth + 1, scale, margin), sdDomain(layer, reflection, g, depth + 1, scale, margin));
+        }
+        if (op->axis == 0) {
+            p.v.x = op->position.x + op->side * fabsf(p.v.x - op->position.x);
+        } else {
+            p.v.y = op->position.y + op->side * fabsf(p.v.y - op->position.y);
+        }
+        return sdDomain(layer, p, g, depth + 1, scale, margin);
     }
-    if (x > bbox.ur.x) {
-        return (x - bbox.ur.x);
+
+    Vec2 q = sub2(p.v, op->position);
+    float offset[2] = {q.x, q.y};
+    float step[2] = {op->step.x, op->step.y};
+    int k[2][2];
+    for (int a = 0; a < 2; a++) {
+        int k0 = (step[a] != 0) ? (int) floorf(offset[a] / step[a]) : 0;
+        k[a][0] = clamp(k0, op->first[a], op->last[a]);
+        k[a][1] = clamp(k0 + 1, op->first[a], op->last[a]);
     }
-    if (y > bbox.ur.y) {
-        return (y - bbox.ur.y);
+    RichDistance d = DEFAULT_RD;
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            if ((i == 1 && k[0][1] == k[0][0]) || (j == 1 && k[1][1] == k[1][0])) {
+                continue; // Same copy
+            }
+            Point copy = p;
+            copy.v.x -= k[0][i] * op->step.x;
+            copy.v.y -= k[1][j] * op->step.y;
+            d = sdMin(d, sdDomain(layer, copy, g, depth + 1, scale, margin));
+        }
     }
-    return -1;
+    return d;
 }
 
-static void sdRenderLayer(Layer* layer, float x, float y, float pixel[4], float* distance) {
-    pixel[0] = 0;
-    pixel[1] = 0;
-    pixel[2] = 0;
-    pixel[3] = 0;
-    float dbb = distanceBbox(layer->bbox, x, y);
-    if (dbb > 0) {
-        *distance = dbb;
-        return;
-    }
-    
+// Fused distance to the geoms of a layer, or of a group. scale is the size in pixels of a unit of p, the distance is in pixels.
+// The geoms farther than margin pixels are left out by their bbox. In a group, margin grows by the rounding of the
+// instances placing it, as their rounding would bring the bbox distance, colorless, below the margin.
+// Always inlined, so the layers, with a scale of 1, pay nothing for the groups.
+static inline __attribute__((always_inline)) RichDistance sdLayer(Layer* layer, Point p, float scale, float margin) {
     RichDistance d = DEFAULT_RD;
-    Point p = {x, y};
     for (size_t i = 0; i < layer->size; i++) {
+        Geom* g = &(layer->geoms[i]);
         RichDistance gd = DEFAULT_RD;
-        switch (layer->geoms[i].type)
+        float dbb;
+        if (g->domain_size > 0) {
+            dbb = distanceBbox(g->bbox, p.v.x, p.v.y);
+            if (dbb*scale-margin <= 0) {
+                PROFILED(g, gd = sdDomain(layer, p, g, 0, scale, margin))
+            } else {
+                STAT(bbox_culls, 1);
+                gd.d = dbb;
+            }
+        } else switch (g->type)
         {
         case POINT:
-            gd = opRound(sdPoint(p, layer->geoms[i].point), layer->geoms[i].round_r);
+            STAT(point_evaluations, 1);
+            PROFILED(g, gd = opRound(sdPoint(p, g->point), g->round_r)) // Cheaper than its bbox
             break;
         case SEGMENT:
-            dbb = distanceBbox(layer->geoms[i].bbox, x, y);
-            if (dbb-(SMOOTH_MIN_FACTOR*5) <= 0) {
-                gd = opRound(sdSegment(p, layer->geoms[i].segment.a, layer->geoms[i].segment.b), layer->geoms[i].round_r);
+            dbb = distanceBbox(g->bbox, p.v.x, p.v.y);
+            if (dbb*scale-margin <= 0) {
+                STAT(segment_evaluations, 1);
+                PROFILED(g, gd = opRound(sdSegment(p, g->segment.a, g->segment.b), g->round_r))
             } else {
+                STAT(bbox_culls, 1);
                 gd.d = dbb;
             }
             break;
         case BEZIER:
-            dbb = distanceBbox(layer->geoms[i].bbox, x, y);
-            if (dbb-(SMOOTH_MIN_FACTOR*5) <= 0) {
-                gd = opRound(sdApproximateBezier(p, &(layer->geoms[i].bezier)), layer->geoms[i].round_r);
+            dbb = distanceBbox(g->bbox, p.v.x, p.v.y);
+            if (dbb*scale-margin <= 0) {
+                STAT(bezier_evaluations, 1);
+                PROFILED(g, gd = opRound(sdApproximateBezier(p, &(g->bezier)), g->round_r))
             } else {
+                STAT(bbox_culls, 1);
                 gd.d = dbb;
             }
             break;
-        default:
+        case INSTANCE:
+            dbb = distanceBbox(g->bbox, p.v.x, p.v.y);
+            if (dbb*scale-margin <= 0) {
+                STAT(instance_evaluations, 1);
+                PROFILED(g, gd = opRound(sdInstance(p, &(g->instance), scale, margin + g->round_r*scale), g->round_r))
+            } else {
+                STAT(bbox_culls, 1);
+                gd.d = dbb;
+            }
             break;
-        }
-
-        switch (layer->fusion)
+        case POLYLINE:
+            dbb = distanceBbox(g->bbox, p.v.x, p.v.y);
+            if (dbb*scale-margin <= 0) {
+                STAT(polyline_evaluations, 1);
+                PROFILED(g, gd = opRound(sdPolyline(p, &(g->polyline)), g->round_r))
+            } else {
+                STAT(bbox_culls, 1);
+                gd.d = dbb;
+            }
+            break;
+        case POLYGON:
+            dbb = distanceBbox(g->bbox, p.v.x, p.v.y);
+            if (dbb*scale-margin <= 0) {
+                STAT(polygon_evaluations, 1);
+                PROFILED(g, gd = opRound(sdPolygon(p, &(g->polygon)), g->round_r))
+            } else {
+                STAT(bbox_culls, 1);
+                gd.d = dbb;
+            }
+            break;
+        default:
+            break;
+        }
+        if (gd.d != FLT_MAX) {
+            gd.d *= scale;
+        }
+
+        switch (layer->fusion)
         {
         case F_MIN:
             d = sdMin(d, gd);
             break;
         case F_SMIN:
+            STAT(smooth_min_blends, 1);
             d = sdSmoothMin(d, gd);
             break;
         default:
             break;
         }
     }
+    return d;
+}
+
+// Distance to the group, with p moved in the space of the group. Same unit as p.
+static RichDistance sdInstance(Point p, Instance* instance, float scale, float margin) {
+    Vec2 q = mul2(sub2(p.v, instance->position), 1 / instance->scale);
+    Point local = {{instance->cos*q.x + instance->sin*q.y, -instance->sin*q.x + instance->cos*q.y}};
+    RichDistance rd = sdLayer(instance->group, local, scale * instance->scale, margin);
+    rd.d /= scale;
+    return rd;
+}
+
+static void sdRenderLayer(Layer* layer, float x, float y, float pixel[4], float* distance) {
+    pixel[0] = 0;
+    pixel[1] = 0;
+    pixel[2] = 0;
+    pixel[3] = 0;
+    float dbb = distanceBbox(layer->bbox, x, y);
+    if (dbb > 0) {
+        STAT(layer_early_outs, 1);
+        *distance = dbb;
+        return;
+    }
+    
+    Point p = {x, y};
+    RichDistance d = sdLayer(layer, p, 1, _params.cull_margin);
     *distance = d.d;
-    float opacity = clamp(-d.d, 0.0, 1.0); // antialiasing, inside the Geom means 1, more than one pixel away means 0
+    // antialiasing, inside the Geom means 1, more than one pixel away means 0
+    float opacity = (_params.antialiasing == AA_NONE) ? (d.d < 0) : clamp(-d.d, 0.0, 1.0);
     copy4(pixel, d.rgba);
     pixel[3] = opacity;
 }
@@ -659,75 +1592,1807 @@ static void sdRenderScene(Scene* scene, float x, float y, float* avgPixel, float
     avgPixel[2] = clamp(avgPixel[2], 0.0, 1.0);
 }
 
+// Render the pixel, with the antialiasing of the params. distance is how many next pixels can be skipped.
+static void sdRenderPixel(Scene* scene, float x, float y, float pixel[3], float* distance) {
+    if (_params.antialiasing != AA_SUPERSAMPLE) {
+        sdRenderScene(scene, x, y, pixel, distance);
+        return;
+    }
+    // The skipped pixels have each of their samples farther from the geoms than the same sample here
+    static const float offsets[4][2] = {{-0.25, -0.25}, {0.25, -0.25}, {-0.25, 0.25}, {0.25, 0.25}};
+    pixel[0] = 0;
+    pixel[1] = 0;
+    pixel[2] = 0;
+    *distance = FLT_MAX;
+    for (int i = 0; i < 4; i++) {
+        float sample[3];
+        float d;
+        sdRenderScene(scene, x + offsets[i][0], y + offsets[i][1], sample, &d);
+        pixel[0] += sample[0] / 4;
+        pixel[1] += sample[1] / 4;
+        pixel[2] += sample[2] / 4;
+        *distance = min(*distance, d);
+    }
+}
+
 /* === */
 
-// Use the read_line callback to read instructions one by one, and parse them into the scene
-extern int read_scene(Scene* scene, size_t canvas_width, size_t canvas_height, int (read_line(char**, size_t*))) {
+/* Reference rendering, see RENDER_REFERENCE */
+
+#define REFERENCE_BEZIER_SAMPLES 128 // Starting points of the Newton refinement
+#define REFERENCE_MAX_ITERATIONS 50
+#define REFERENCE_EPSILON 1e-12
+
+typedef struct RefDistance {
+    double d;
+    double rgba[4];
+} RefDistance;
+
+static double refLength(double x, double y) {
+    return sqrt(x*x + y*y);
+}
+
+static RefDistance refPoint(double x, double y, Geom* g) {
+    RefDistance rd;
+    rd.d = refLength(x - g->point.v.x, y - g->point.v.y) - g->round_r;
+    copy4(rd.rgba, g->point.rgba);
+    return rd;
+}
+
+// Same as sdSegment, in double
+static RefDistance refSegment(double x, double y, Geom* g) {
+    Geom* ag = g->segment.a;
+    Geom* bg = g->segment.b;
+    double pax = x - ag->point.v.x, pay = y - ag->point.v.y;
+    double bax = bg->point.v.x - ag->point.v.x, bay = bg->point.v.y - ag->point.v.y;
+    double h = clamp((pax*bax + pay*bay) / (bax*bax + bay*bay), 0.0, 1.0);
+    RefDistance rd;
+    rd.d = refLength(pax - bax*h, pay - bay*h) - g->round_r;
+
+    double dab = refLength(bax, bay);
+    double ar = ag->round_r / dab;
+    double br = bg->round_r / dab;
+    double ch = clamp(h-ar, 0.0, (1-(ar+br))) / (1 - (ar+br));
+    mix4(rd.rgba, ag->point.rgba, bg->point.rgba, ch);
+    return rd;
+}
+
+// Every segment of the polyline, as refSegment
+static RefDistance refPolyline(double x, double y, Geom* g) {
+    Polyline* pl = &(g->polyline);
+    RefDistance rd = {DBL_MAX, {0, 0, 0, 0}};
+    for (size_t i = 0; i + 1 < pl->size; i++) {
+        Vertex* a = &(pl->vertices[i]);
+        Vertex* b = &(pl->vertices[i + 1]);
+        double pax = x - a->point.v.x, pay = y - a->point.v.y;
+        double bax = b->point.v.x - a->point.v.x, bay = b->point.v.y - a->point.v.y;
+        double h = clamp((pax*bax + pay*bay) / (bax*bax + bay*bay), 0.0, 1.0);
+        double d = refLength(pax - bax*h, pay - bay*h) - g->round_r;
+        if (d > rd.d) {
+            continue;
+        }
+        rd.d = d;
+        double dab = refLength(bax, bay);
+        double ar = a->round_r / dab;
+        double br = b->round_r / dab;
+        double ch = clamp(h-ar, 0.0, (1-(ar+br))) / (1 - (ar+br));
+        mix4(rd.rgba, a->point.rgba, b->point.rgba, ch);
+    }
+    return rd;
+}
+
+// Every edge of the polygon, the sign from the count of crossings as sdPolygon
+static RefDistance refPolygon(double x, double y, Geom* g) {
+    Polyline* pl = &(g->polygon.outline);
+    double best = DBL_MAX;
+    size_t best_i = 0;
+    int inside = 0;
+    for (size_t i = 0; i + 1 < pl->size; i++) {
+        Vertex* a = &(pl->vertices[i]);
+        Vertex* b = &(pl->vertices[i + 1]);
+        double pax = x - a->point.v.x, pay = y - a->point.v.y;
+        double bax = b->point.v.x - a->point.v.x, bay = b->point.v.y - a->point.v.y;
+        double h = clamp((pax*bax + pay*bay) / (bax*bax + bay*bay), 0.0, 1.0);
+        double d = refLength(pax - bax*h, pay - bay*h);
+        if (d < best) {
+            best = d;
+            best_i = i;
+        }
+        int c0 = y >= a->point.v.y;
+        int c1 = y < b->point.v.y;
+        int c2 = bax*pay > bay*pax;
+        inside ^= (c0 && c1 && c2) || (!c0 && !c1 && !c2);
+    }
+    RefDistance rd;
+    rd.d = (inside ? -best : best) - g->round_r;
+    Vertex* a = &(pl->vertices[best_i]);
+    Vertex* b = &(pl->vertices[best_i + 1]);
+    double pax = x - a->point.v.x, pay = y - a->point.v.y;
+    double bax = b->point.v.x - a->point.v.x, bay = b->point.v.y - a->point.v.y;
+    double h = clamp((pax*bax + pay*bay) / (bax*bax + bay*bay), 0.0, 1.0);
+    double dab = refLength(bax, bay);
+    double ar = a->round_r / dab;
+    double br = b->round_r / dab;
+    double ch = clamp(h-ar, 0.0, (1-(ar+br))) / (1 - (ar+br));
+    mix4(rd.rgba, a->point.rgba, b->point.rgba, ch);
+    return rd;
+}
+
+// Point of the curve, and its derivative, at t. De Casteljau's algorithm in double.
+static void refBezier(Bezier* B, double t, double* x, double* y, double* dx, double* dy) {
+    double px[MAX_BEZIER_POINT], py[MAX_BEZIER_POINT];
+    for (size_t i = 0; i < B->size; i++) {
+        px[i] = B->points[i]->point.v.x;
+        py[i] = B->points[i]->point.v.y;
+    }
+    *dx = 0;
+    *dy = 0;
+    for (size_t r = 1; r < B->size; r++) {
+        if (r == B->size - 1) {
+            // The last two points give the tangent
+            *dx = (B->size - 1) * (px[1] - px[0]);
+            *dy = (B->size - 1) * (py[1] - py[0]);
+        }
+        for (size_t i = 0; i < B->size - r; i++) {
+            px[i] = px[i] + (px[i+1] - px[i]) * t;
+            py[i] = py[i] + (py[i+1] - py[i]) * t;
+        }
+    }
+    *x = px[0];
+    *y = py[0];
+}
+
+// Distance to the Bezier curve: dense sampling, then Newton's method on the squared distance in double
+static RefDistance refBezierDistance(double x, double y, Geom* g) {
+    Bezier* B = &(g->bezier);
+    double bx, by, dx, dy;
+    double best_t = 0;
+    double best = DBL_MAX;
+    for (int i = 0; i <= REFERENCE_BEZIER_SAMPLES; i++) {
+        double t = ((double) i) / REFERENCE_BEZIER_SAMPLES;
+        refBezier(B, t, &bx, &by, &dx, &dy);
+        double d = (bx - x)*(bx - x) + (by - y)*(by - y);
+        if (d < best) {
+            best = d;
+            best_t = t;
+        }
+    }
+    double t = best_t;
+    for (int i = 0; i < REFERENCE_MAX_ITERATIONS; i++) {
+        refBezier(B, t, &bx, &by, &dx, &dy);
+        double numerator = (bx - x)*dx + (by - y)*dy;
+        double denominator = dx*dx + dy*dy;
+        if (denominator == 0 || fabs(numerator) < REFERENCE_EPSILON * denominator) {
+            break;
+        }
+        t = clamp(t - numerator / denominator, 0.0, 1.0);
+    }
+    refBezier(B, t, &bx, &by, &dx, &dy);
+    RefDistance rd;
+    rd.d = min(sqrt(best), refLength(bx - x, by - y)) - g->round_r;
+    copy4(rd.rgba, B->points[0]->point.rgba);
+    return rd;
+}
+
+static RefDistance refInstance(double x, double y, Geom* g, double scale);
+
+// Same as sdSmoothMin, in double
+static RefDistance refSmoothMin(RefDistance a, RefDistance b) {
+    double k = _params.smooth_min_factor;
+    double h = 1.0 - min(fabs(a.d - b.d)/(6.0*k), 1.0);
+    double w = h*h*h;
+    double m = (a.d < b.d) ? w*0.5 : 1.0 - w*0.5;
+    RefDistance rd;
+    rd.d = min(a.d, b.d) - w*k;
+    mix4(rd.rgba, a.rgba, b.rgba, m);
+    return rd;
+}
+
+// Same as sdShape, in double
+static RefDistance refShape(double x, double y, Geom* g, double scale) {
+    RefDistance gd = {DBL_MAX, {0, 0, 0, 0}};
+    switch (g->type) {
+    case POINT:
+        gd = refPoint(x, y, g);
+        break;
+    case SEGMENT:
+        gd = refSegment(x, y, g);
+        break;
+    case BEZIER:
+        gd = refBezierDistance(x, y, g);
+        break;
+    case INSTANCE:
+        gd = refInstance(x, y, g, scale);
+        break;
+    case POLYLINE:
+        gd = refPolyline(x, y, g);
+        break;
+    case POLYGON:
+        gd = refPolygon(x, y, g);
+        break;
+    default:
+        break;
+    }
+    return gd;
+}
+
+// Same as sdDomain, in double, with both copies of MIRROR and every copy of REPEAT
+static RefDistance refDomain(Layer* layer, double x, double y, Geom* g, int depth, double scale) {
+    if (depth == g->domain_size) {
+        return refShape(x, y, g, scale);
+    }
+    DomainOp* op = &(layer->domains[g->domain_first + depth]);
+    if (op->type == DOMAIN_MIRROR) {
+        RefDistance d = refDomain(layer, x, y, g, depth + 1, scale);
+        RefDistance rd = (op->axis == 0) ? refDomain(layer, 2.0*op->position.x - x, y, g, depth + 1, scale)
+            : refDomain(layer, x, 2.0*op->position.y - y, g, depth + 1, scale);
+        return (rd.d < d.d) ? rd : d;
+    }
+    RefDistance d = {DBL_MAX, {0, 0, 0, 0}};
+    for (int i = op->first[0]; i <= op->last[0]; i++) {
+        for (int j = op->first[1]; j <= op->last[1]; j++) {
+            RefDistance cd = refDomain(layer, x - i * (double) op->step.x, y - j * (double) op->step.y, g, depth + 1, scale);
+            if (cd.d < d.d) {
+                d = cd;
+            }
+        }
+    }
+    return d;
+}
+
+// Same as sdLayer, in double, without the bbox shortcuts
+static RefDistance refLayer(Layer* layer, double x, double y, double scale) {
+    RefDistance d = {DBL_MAX, {0, 0, 0, 0}};
+    for (size_t i = 0; i < layer->size; i++) {
+        Geom* g = &(layer->geoms[i]);
+        RefDistance gd = (g->domain_size == 0) ? refShape(x, y, g, scale) : refDomain(layer, x, y, g, 0, scale);
+        if (gd.d != DBL_MAX) {
+            gd.d *= scale;
+        }
+        if (layer->fusion == F_SMIN) {
+            d = refSmoothMin(d, gd);
+        } else if (gd.d < d.d) {
+            d = gd;
+        }
+    }
+    return d;
+}
+
+// Same as sdInstance, in double
+static RefDistance refInstance(double x, double y, Geom* g, double scale) {
+    Instance* in = &(g->instance);
+    double qx = (x - in->position.x) / in->scale;
+    double qy = (y - in->position.y) / in->scale;
+    RefDistance rd = refLayer(in->group, in->cos*qx + in->sin*qy, -in->sin*qx + in->cos*qy, scale * in->scale);
+    rd.d = rd.d / scale - g->round_r;
+    return rd;
+}
+
+// Evaluate every geom of every layer, without the bbox shortcuts
+static void refRenderScene(Scene* scene, double x, double y, float pixel[3]) {
+    double sum[3] = {0, 0, 0};
+    for (size_t l = 0; l < scene->size; l++) {
+        RefDistance d = refLayer(&(scene->layer[l]), x, y, 1);
+        double opacity = clamp(-d.d, 0.0, 1.0);
+        for (int c = 0; c < 3; c++) {
+            sum[c] += d.rgba[c] * opacity;
+        }
+    }
+    for (int c = 0; c < 3; c++) {
+        pixel[c] = clamp(sum[c], 0.0, 1.0);
+    }
+}
+/* === */
+
+extern Scene* create_scene() {
+    Scene* scene = malloc(sizeof(Scene));
+    if (scene) {
+        scene->size = 0;
+        scene->groups = 0;
+        scene->current = NULL;
+    }
+    return scene;
+}
+
+extern void destroy_scene(Scene* scene) {
+    free(scene);
+}
+
+extern void set_message_callback(CallbackMessage cb_message) {
+    message_callback = cb_message;
+}
+
+extern void set_phase_callback(CallbackPhase cb_phase) {
+    phase_callback = cb_phase;
+}
+
+// The parser reads the canvas of the scene from the globals, set again before each parse
+static void set_scene_canvas(Scene* scene, size_t canvas_width, size_t canvas_height) {
+    scene->canvas_width = canvas_width;
+    scene->canvas_height = canvas_height;
+    scene->diag = sqrtf(canvas_width*canvas_width + canvas_height*canvas_height);
+    _canvas_width = scene->canvas_width;
+    _canvas_height = scene->canvas_height;
+    _diag = scene->diag;
+}
+
+static int parse_scene(Scene* scene, size_t canvas_width, size_t canvas_height, CallbackReadLine read_line) {
     int res = OK;
 
-    _canvas_width = canvas_width;
-    _canvas_height = canvas_height;
-    _diag = sqrtf(canvas_width*canvas_width + canvas_height*canvas_height);
+    scene->size = 0;
+    scene->groups = 0;
+    scene->current = NULL;
+    set_scene_canvas(scene, canvas_width, canvas_height);
 
     size_t len = 512;
     int read = 0;
     char* line = malloc(sizeof(unsigned char) * len);
+    _line = 0;
+    phase(PHASE_PARSE, 1);
+    double layer_start = trace_now();
     while ((read = read_line(&line, &len)) > 0) {
         size_t cursor = 0;
+        _line++;
         if (line[read-1] == '\n') {line[--read] = '\0';} // Remove LF
         if (line[read-1] == '\r') {line[--read] = '\0';} // Remove CR
+        size_t layers = scene->size;
         if(parse_line(scene, line, &cursor, read) != OK) {
             LOG_E("Got error %d for line: %s", res, line);
         }
+        if (scene->size != layers) {
+            // The span of a layer include the reading of the line starting the next one
+            trace_span("parse layer", (long) layers - 1, layer_start);
+            layer_start = trace_now();
+        }
     }
     if(line) {free(line);}
+    if (scene->current != NULL) {
+        set_bbox_layer(scene->current);
+    }
+    trace_span("parse layer", (long) scene->size - 1, layer_start);
+    phase(PHASE_PARSE, 0);
+    return res;
+}
 
-    // Compute Layer bbox
-    for (size_t i = 0; i < scene->size; i++) {
-        Layer* l = &(scene->layer[i]);
-        Geom g = l->geoms[0];
-        l->bbox.bl = g.bbox.bl;
-        l->bbox.ur = g.bbox.ur;
-        for (size_t j = 1; j < l->size; j++) {
-            g = l->geoms[j];
-            l->bbox.bl.x = min(l->bbox.bl.x, g.bbox.bl.x);
-            l->bbox.bl.y = min(l->bbox.bl.y, g.bbox.bl.y);
-            l->bbox.ur.x = max(l->bbox.ur.x, g.bbox.ur.x);
-            l->bbox.ur.y = max(l->bbox.ur.y, g.bbox.ur.y);
+// Use the read_line callback to read instructions one by one, and parse them into the scene
+extern int read_scene(Scene* scene, size_t canvas_width, size_t canvas_height, CallbackReadLine read_line) {
+    int res = OK;
+    END_IF_NOK(parse_scene(scene, canvas_width, canvas_height, read_line))
+
+    // Drop the geoms that cannot reach the canvas, and set the layer bboxes
+    phase(PHASE_INDEX, 1);
+    cull_scene(scene, 0, 0, canvas_width, canvas_height);
+    phase(PHASE_INDEX, 0);
+    return res;
+}
+
+/* Scene builder, see begin_scene */
+// Start of a new geom in the current layer, after the checks of its builder
+static Geom* add_geom(Scene* scene, char type, float round_r) {
+    Geom* g = &(scene->current->geoms[scene->current->size++]);
+    g->type = type;
+    g->round_r = round_r * scene->diag;
+    g->domain_size = 0;
+    g->line = ++_line;
+#ifdef RENDER_STATS
+    g->profile_evaluations = 0;
+    g->profile_ns = 0;
+#endif
+    return g;
+}
+
+// Check the current layer have room for count geoms
+static int reserve_geoms(Scene* scene, size_t count) {
+    if (scene->current == NULL) {
+        LOG_E("Trying to add geometries without layer, call scene_add_layer first%s", "");
+        return E_PARSE_NEED_LAYER;
+    }
+    if (scene->current->size + count > MAX_GEOMS_PER_LAYER) {
+        LOG_E("Reached max geom count %d", MAX_GEOMS_PER_LAYER);
+        return E_BOUND_REACHED;
+    }
+    return OK;
+}
+
+// Check the indexes all reference a point of the current layer
+static int check_point_indexes(Layer* layer, const int* indexes, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int index = indexes[i];
+        if (index < 0 || index >= layer->size || layer->geoms[index].type != POINT) {
+            LOG_E("Bad Point Geom index %d", index);
+            return E_PARSE_ISEGMENT_BAD_INDEX;
         }
     }
+    return OK;
+}
+
+// Copy the points as the vertices of a polyline, at the end of the layer ones
+static int copy_vertices(Layer* layer, const int* indexes, size_t count, size_t extra, Polyline* pl) {
+    int res = OK;
+    END_IF_NOK(check_point_indexes(layer, indexes, count))
+    if (layer->vertices_size + count + extra > MAX_VERTICES_PER_LAYER) {
+        LOG_E("Reached max polyline vertex count %d", MAX_VERTICES_PER_LAYER);
+        return E_BOUND_REACHED;
+    }
+    pl->vertices = &(layer->vertices[layer->vertices_size]);
+    pl->size = count;
+    pl->chunks = NULL;
+    for (size_t i = 0; i < count; i++) {
+        pl->vertices[i].point = layer->geoms[indexes[i]].point;
+        pl->vertices[i].round_r = layer->geoms[indexes[i]].round_r;
+    }
     return res;
 }
 
-// Render the scene, and write the resulting pixel one by one using the handle_pixel callback
-extern void render_canvas(Scene* scene, size_t canvas_width, size_t canvas_height, void (*handle_pixel)(int, int, float[3])) {
-    for (size_t y = 0; y < canvas_height; y++) {
-        size_t next_pixel = 0;
-        float last_distance = 0;
-        for (size_t x = 0; x < canvas_width; x++) {
-            float pixel[3] = {0, 0, 0};
-            if (x >= next_pixel) { // Simple optimization, since we know the distance to the next pixel
-                sdRenderScene(scene, x, y, pixel, &last_distance);
-                next_pixel = x + (int)clamp(last_distance, 0, canvas_width);
-            } else {
-                // Uncomment to see the distance as red gradiant.
-                // With the optimization, red streak means a lot of pixels are skipped.
-                // pixel[0] = clamp(last_distance / _diag, 0, 1);
+extern int begin_scene(Scene* scene, size_t canvas_width, size_t canvas_height) {
+    scene->size = 0;
+    scene->groups = 0;
+    scene->current = NULL;
+    set_scene_canvas(scene, canvas_width, canvas_height);
+    _line = 0;
+    return OK;
+}
+
+extern int scene_add_layer(Scene* scene, int fusion) {
+    if (scene->current != NULL) {
+        set_bbox_layer(scene->current);
+    }
+    if (scene->size >= MAX_LAYER) {
+        LOG_E("Reached max layer count %d", MAX_LAYER);
+        return E_BOUND_REACHED;
+    }
+    Layer* layer = &(scene->layer[scene->size++]);
+    reset_layer(layer, fusion);
+    scene->current = layer;
+    return OK;
+}
+
+extern int scene_add_points(Scene* scene, size_t count, const float* xy, const float* rgba, const float* radius) {
+    int res = OK;
+    END_IF_NOK(reserve_geoms(scene, count))
+    for (size_t i = 0; i < count; i++) {
+        Geom* g = add_geom(scene, POINT, radius ? radius[i] : 0);
+        g->point.v.x = xy[2*i] * scene->canvas_width;
+        g->point.v.y = xy[2*i + 1] * scene->canvas_height;
+        if (rgba) {
+            copy4(g->point.rgba, (rgba + 4*i))
+        } else {
+            g->point.rgba[0] = 1;
+            g->point.rgba[1] = 0;
+            g->point.rgba[2] = 1;
+            g->point.rgba[3] = 1;
+        }
+        set_bbox_point(g);
+        if (radius) {
+            grow_bbox_round(g);
+        }
+    }
+    return res;
+}
+
+extern int scene_add_segments(Scene* scene, size_t count, const int* indexes, const float* radius) {
+    int res = OK;
+    END_IF_NOK(reserve_geoms(scene, count))
+    Layer* layer = scene->current;
+    END_IF_NOK(check_point_indexes(layer, indexes, 2*count))
+    for (size_t i = 0; i < count; i++) {
+        Geom* g = add_geom(scene, SEGMENT, radius ? radius[i] : 0);
+        g->segment.a = &(layer->geoms[indexes[2*i]]);
+        g->segment.b = &(layer->geoms[indexes[2*i + 1]]);
+        set_bbox_segment(g);
+        if (radius) {
+            grow_bbox_round(g);
+        }
+    }
+    return res;
+}
+
+extern int scene_add_polyline(Scene* scene, size_t count, const int* indexes, float radius) {
+    int res = OK;
+    END_IF_NOK(reserve_geoms(scene, 1))
+    Layer* layer = scene->current;
+    Polyline pl;
+    END_IF_NOK(copy_vertices(layer, indexes, count, 0, &pl))
+    END_IF_NOK(set_polyline_chunks(layer, &pl))
+    Geom* g = add_geom(scene, POLYLINE, radius);
+    g->polyline = pl;
+    set_bbox_polyline(g);
+    if (radius > 0) {
+        grow_bbox_round(g);
+    }
+    return res;
+}
+
+extern int scene_add_polygon(Scene* scene, size_t count, const int* indexes, float radius) {
+    int res = OK;
+    END_IF_NOK(reserve_geoms(scene, 1))
+    Layer* layer = scene->current;
+    Polygon pg;
+    END_IF_NOK(copy_vertices(layer, indexes, count, 1, &(pg.outline)))
+    END_IF_NOK(set_polygon(layer, &pg))
+    Geom* g = add_geom(scene, POLYGON, radius);
+    g->polygon = pg;
+    g->bbox = pg.box;
+    if (radius > 0) {
+        grow_bbox_round(g);
+    }
+    return res;
+}
+
+extern int end_scene(Scene* scene) {
+    if (scene->current != NULL) {
+        set_bbox_layer(scene->current);
+    }
+    phase(PHASE_INDEX, 1);
+    cull_scene(scene, 0, 0, scene->canvas_width, scene->canvas_height);
+    phase(PHASE_INDEX, 0);
+    return OK;
+}
+/* === */
+
+// Points without radius are never inside in a min layer, like the vertices of a polygon
+static inline int point_visible(Layer* layer, Geom* g) {
+    return !(layer->fusion == F_MIN && g->type == POINT && g->round_r <= 0);
+}
+
+// Extra distance at which a geom still change the pixels of its layer
+static float influence_margin(Layer* layer) {
+    return (layer->fusion == F_SMIN) ? 2*SMOOTH_MIN_RANGE : 0;
+}
+
+// Keep only the geoms flagged in keep, and fix the references between geoms
+static void compact_layer(Layer* layer, const char* keep) {
+    size_t index[MAX_GEOMS_PER_LAYER];
+    size_t size = 0;
+    for (size_t i = 0; i < layer->size; i++) {
+        if (!keep[i]) {
+            continue;
+        }
+        index[i] = size;
+        Geom* g = &(layer->geoms[size++]);
+        *g = layer->geoms[i]; // Never move a geom backward, references always point to an earlier geom
+        switch (g->type)
+        {
+        case SEGMENT:
+            g->segment.a = &(layer->geoms[index[g->segment.a - layer->geoms]]);
+            g->segment.b = &(layer->geoms[index[g->segment.b - layer->geoms]]);
+            break;
+        case BEZIER:
+            for (size_t j = 0; j < g->bezier.size; j++) {
+                g->bezier.points[j] = &(layer->geoms[index[g->bezier.points[j] - layer->geoms]]);
             }
-            handle_pixel(x, y, pixel);
+            break;
+        default:
+            break;
         }
     }
+    layer->size = size;
 }
 
-extern int read_and_render(size_t canvas_width, size_t canvas_height, CallbackReadLine cb_readline, CallbackPixel cb_pixel, CallbackMessage cb_message) {
-    message_callback = cb_message;
+static void cull_layer(Layer* layer, size_t x0, size_t y0, size_t x1, size_t y1) {
+    char keep[MAX_GEOMS_PER_LAYER];
+    float m = influence_margin(layer);
+    memset(keep, 0, layer->size);
+    for (size_t j = layer->size; j-- > 0;) {
+        Geom* g = &(layer->geoms[j]);
+        int visible = point_visible(layer, g);
+        keep[j] = keep[j] || (visible && (g->bbox.ur.x + m >= x0) && (g->bbox.bl.x - m <= x1 - 1) && (g->bbox.ur.y + m >= y0) && (g->bbox.bl.y - m <= y1 - 1));
+        if (!keep[j]) {
+            continue;
+        }
+        if (!visible) {
+            g->type = CONTROL;
+        }
+        // Referenced geoms always come first, so they are flagged before being visited
+        if (g->type == SEGMENT) {
+            keep[g->segment.a - layer->geoms] = 1;
+            keep[g->segment.b - layer->geoms] = 1;
+        } else if (g->type == BEZIER) {
+            for (size_t k = 0; k < g->bezier.size; k++) {
+                keep[g->bezier.points[k] - layer->geoms] = 1;
+            }
+        }
+    }
+    compact_layer(layer, keep);
+    set_bbox_layer(layer);
+}
+
+// Drop the geoms that cannot change any pixel of the region [x0, x1[ x [y0, y1[.
+// The points still referenced by a kept geom are kept, hidden from the render when they cannot change a pixel anywhere.
+extern void cull_scene(Scene* scene, size_t x0, size_t y0, size_t x1, size_t y1) {
+    double start = trace_now();
+    for (size_t i = 0; i < scene->size; i++) {
+        cull_layer(&(scene->layer[i]), x0, y0, x1, y1);
+    }
+    trace_span("cull", -1, start);
+}
+
+/* Animation, see update_point */
+extern int read_animated_scene(Scene* scene, size_t canvas_width, size_t canvas_height, CallbackReadLine read_line) {
     int res = OK;
+    END_IF_NOK(parse_scene(scene, canvas_width, canvas_height, read_line))
+
+    // Nothing is dropped, as the updates may bring any geom on the canvas. The points without radius are hidden, as by cull_scene.
+    phase(PHASE_INDEX, 1);
+    for (size_t i = 0; i < scene->size; i++) {
+        Layer* layer = &(scene->layer[i]);
+        for (size_t j = 0; j < layer->size; j++) {
+            if (!point_visible(layer, &(layer->geoms[j]))) {
+                layer->geoms[j].type = CONTROL;
+            }
+        }
+        set_bbox_layer(layer);
+    }
+    phase(PHASE_INDEX, 0);
+    return res;
+}
+
+// Grow dirty to hold the pixels that the geoms of the layer inside bbox can change
+static void add_dirty_box(Scene* scene, Layer* layer, Bbox bbox, size_t dirty[4]) {
+    float m = influence_margin(layer) + 2; // Antialiasing, and the pixel centers
+    if (bbox.ur.x + m < 0 || bbox.ur.y + m < 0 || bbox.bl.x - m > scene->canvas_width || bbox.bl.y - m > scene->canvas_height) {
+        return; // Out of the canvas, or empty
+    }
+    long x0 = max(0, (long) floorf(bbox.bl.x - m));
+    long y0 = max(0, (long) floorf(bbox.bl.y - m));
+    long x1 = min(scene->canvas_width, (long) ceilf(bbox.ur.x + m) + 1);
+    long y1 = min(scene->canvas_height, (long) ceilf(bbox.ur.y + m) + 1);
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+    if (dirty[0] >= dirty[2] || dirty[1] >= dirty[3]) {
+        dirty[0] = x0;
+        dirty[1] = y0;
+        dirty[2] = x1;
+        dirty[3] = y1;
+    } else {
+        dirty[0] = min(dirty[0], (size_t) x0);
+        dirty[1] = min(dirty[1], (size_t) y0);
+        dirty[2] = max(dirty[2], (size_t) x1);
+        dirty[3] = max(dirty[3], (size_t) y1);
+    }
+}
+
+static void add_dirty_bbox(Scene* scene, Layer* layer, Geom* g, size_t dirty[4]) {
+    if (g->type == CONTROL) {
+        return; // Not rendered
+    }
+    add_dirty_box(scene, layer, g->bbox, dirty);
+}
+
+static int uses_point(Geom* g, Geom* point) {
+    if (g == point) {
+        return 1;
+    }
+    if (g->type == SEGMENT) {
+        return g->segment.a == point || g->segment.b == point;
+    }
+    if (g->type == BEZIER) {
+        for (size_t k = 0; k < g->bezier.size; k++) {
+            if (g->bezier.points[k] == point) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
 
-    Scene scene;
-    scene.size = 0;
+extern int update_point(Scene* scene, size_t layer_index, size_t index, const float* xy, const float* rgba, const float* radius, size_t dirty[4]) {
+    if (layer_index >= scene->size || index >= scene->layer[layer_index].size
+        || (scene->layer[layer_index].geoms[index].type != POINT && scene->layer[layer_index].geoms[index].type != CONTROL)) {
+        LOG_E("Bad Point Geom index %zu in layer %zu", index, layer_index);
+        return E_PARSE_ISEGMENT_BAD_INDEX;
+    }
+    Layer* layer = &(scene->layer[layer_index]);
+    Geom* point = &(layer->geoms[index]);
+
+    // The point, and the geoms drawn from it. Their old place must be rendered again.
+    Geom* users[MAX_GEOMS_PER_LAYER];
+    size_t count = 0;
+    for (size_t j = 0; j < layer->size; j++) {
+        Geom* g = &(layer->geoms[j]);
+        if (!uses_point(g, point)) {
+            continue;
+        }
+        if (g->domain_size > 0) {
+            LOG_E("Cannot update the point %zu of layer %zu, used by a geom with domain operators", index, layer_index);
+            return E_UPDATE_UNSUPPORTED;
+        }
+        users[count++] = g;
+    }
+    for (size_t i = 0; i < count; i++) {
+        add_dirty_bbox(scene, layer, users[i], dirty);
+    }
 
-    res = read_scene(&scene, canvas_width, canvas_height, cb_readline);
-    render_canvas(&scene, canvas_width, canvas_height, cb_pixel);
+    if (xy) {
+        point->point.v.x = xy[0] * scene->canvas_width;
+        point->point.v.y = xy[1] * scene->canvas_height;
+    }
+    if (rgba) {
+        copy4(point->point.rgba, rgba)
+    }
+    if (radius) {
+        point->round_r = *radius * scene->diag;
+    }
+    // As point_visible, which cannot be used on a point hidden as CONTROL
+    point->type = (layer->fusion == F_MIN && point->round_r <= 0) ? CONTROL : POINT;
+
+    // Their new place
+    for (size_t i = 0; i < count; i++) {
+        Geom* g = users[i];
+        if (g->type == SEGMENT) {
+            set_bbox_segment(g);
+        } else if (g->type == BEZIER) {
+            set_bbox_bezier(g);
+            g->bezier.lut_state = LUT_NONE;
+        } else {
+            set_bbox_point(g);
+        }
+        if (g->round_r > 0) {
+            grow_bbox_round(g);
+        }
+        add_dirty_bbox(scene, layer, g, dirty);
+    }
+    set_bbox_layer(layer);
+    return OK;
+}
+/* === */
+
+/* Watch, see reread_layer */
+extern int reread_layer(Scene* scene, size_t layer_index, size_t first_line, CallbackReadLine read_line, size_t dirty[4]) {
+    if (layer_index >= scene->size) {
+        LOG_E("Bad layer index %zu", layer_index);
+        return E_INVALID_PARAMS;
+    }
+    int res = OK;
+    Layer* layer = &(scene->layer[layer_index]);
+    add_dirty_box(scene, layer, layer->bbox, dirty);
+
+    // Parsed as if the layers after it were not read yet, so that its LAYER line starts it again
+    size_t layers = scene->size;
+    size_t groups = scene->groups;
+    Layer* current = scene->current;
+    scene->size = layer_index;
+    scene->current = NULL;
+    size_t len = 512;
+    int read = 0;
+    char* line = malloc(sizeof(unsigned char) * len);
+    set_scene_canvas(scene, scene->canvas_width, scene->canvas_height); // Another scene may have been parsed since
+    _line = first_line - 1;
+    while (res == OK && (read = read_line(&line, &len)) > 0) {
+        size_t cursor = 0;
+        _line++;
+        if (line[read-1] == '\n') {line[--read] = '\0';} // Remove LF
+        if (line[read-1] == '\r') {line[--read] = '\0';} // Remove CR
+        if (parse_line(scene, line, &cursor, read) != OK) {
+            LOG_E("Got error for line: %s", line);
+        }
+        if (scene->size != layer_index + 1 || scene->groups != groups) {
+            LOG_E("Line %zu is not in the layer %zu: %s", _line, layer_index, line);
+            res = E_INVALID_PARAMS;
+        }
+    }
+    if(line) {free(line);}
+    scene->size = layers;
+    scene->current = current;
+    if (res != OK) {
+        return res;
+    }
+    cull_layer(layer, 0, 0, scene->canvas_width, scene->canvas_height);
+    add_dirty_box(scene, layer, layer->bbox, dirty);
+    return res;
+}
+/* === */
+
+/* Level of detail, see simplify_scene */
+
+#define LOD_SAMPLES 32 // Along a Bezier, where the error of its degree reduction is measured
+#define LOD_MAX_CHAIN 64 // Segments merged into one
+
+typedef struct LodPoint {
+    long cx; // Cell of the grid
+    long cy;
+    size_t index;
+} LodPoint;
+
+static int same_color(Geom* a, Geom* b) {
+    return memcmp(a->point.rgba, b->point.rgba, sizeof(a->point.rgba)) == 0;
+}
+
+// De Casteljau's algorithm, on points not stored in geoms
+static Vec2 bezier_points(float t, const Vec2* points, size_t size) {
+    Vec2 temp[MAX_BEZIER_POINT];
+    memcpy(temp, points, size * sizeof(Vec2));
+    for (size_t r = 1; r < size; r++) {
+        for (size_t i = 0; i < size - r; i++) {
+            temp[i] = lerp2(temp[i], temp[i+1], t);
+        }
+    }
+    return temp[0];
+}
+
+// Add count to the references held by g
+static void add_references(Layer* layer, Geom* g, int* refs, int count) {
+    if (g->type == SEGMENT) {
+        refs[g->segment.a - layer->geoms] += count;
+        refs[g->segment.b - layer->geoms] += count;
+    } else if (g->type == BEZIER) {
+        for (size_t k = 0; k < g->bezier.size; k++) {
+            refs[g->bezier.points[k] - layer->geoms] += count;
+        }
+    }
+}
+
+// Set the bbox of a geom changed by the simplification
+static void lod_set_bbox(Geom* g) {
+    switch (g->type)
+    {
+    case SEGMENT:
+        set_bbox_segment(g);
+        break;
+    case BEZIER:
+        set_bbox_bezier(g);
+        break;
+    default:
+        set_bbox_point(g);
+        break;
+    }
+    grow_bbox_round(g);
+}
+
+// A segment or Bezier with a bbox diagonal below tolerance becomes a point, grown by half the diagonal to cover it
+static int lod_shrink(Layer* layer, Geom* g, float tolerance, int* refs) {
+    Bbox rounded = g->bbox;
+    if (g->type == SEGMENT) {
+        set_bbox_segment(g);
+    } else {
+        set_bbox_bezier(g);
+    }
+    float diagonal = distance2(g->bbox.bl, g->bbox.ur);
+    if (diagonal > tolerance) {
+        g->bbox = rounded;
+        return 0;
+    }
+    Geom* a = (g->type == SEGMENT) ? g->segment.a : g->bezier.points[0];
+    Geom* b = (g->type == SEGMENT) ? g->segment.b : a; // A Bezier has the color of its first point
+    add_references(layer, g, refs, -1); // Before point overwrites the references
+    mix4(g->point.rgba, a->point.rgba, b->point.rgba, 0.5);
+    g->type = POINT;
+    g->point.v = mul2(add2(g->bbox.bl, g->bbox.ur), 0.5);
+    g->round_r += diagonal / 2;
+    lod_set_bbox(g);
+    return 1;
+}
+
+// Lower the degree of a Bezier, while the curve stays within tolerance of the original.
+// Only the inner points referenced by this curve alone, and not visible, can be moved.
+static int lod_reduce_bezier(Layer* layer, Geom* g, float tolerance, int* refs) {
+    Bezier* bez = &(g->bezier);
+    for (size_t i = 1; i + 1 < bez->size; i++) {
+        if (refs[bez->points[i] - layer->geoms] != 1 || bez->points[i]->round_r > 0) {
+            return 0;
+        }
+    }
+    Vec2 original[MAX_BEZIER_POINT];
+    Vec2 current[MAX_BEZIER_POINT];
+    for (size_t i = 0; i < bez->size; i++) {
+        original[i] = bez->points[i]->point.v;
+        current[i] = original[i];
+    }
+    size_t size = bez->size;
+    while (size > 2) {
+        // Blend of the forward and backward inversions of the degree elevation, exact when the curve was elevated
+        size_t n = size - 1;
+        Vec2 forward[MAX_BEZIER_POINT];
+        Vec2 backward[MAX_BEZIER_POINT];
+        Vec2 reduced[MAX_BEZIER_POINT];
+        forward[0] = current[0];
+        for (size_t i = 1; i < n; i++) {
+            forward[i] = mul2(sub2(mul2(current[i], n), mul2(forward[i-1], i)), 1.0 / (n - i));
+        }
+        backward[n-1] = current[n];
+        for (size_t i = n - 1; i >= 1; i--) {
+            backward[i-1] = mul2(sub2(mul2(current[i], n), mul2(backward[i], n - i)), 1.0 / i);
+        }
+        for (size_t i = 0; i < n; i++) {
+            reduced[i] = lerp2(forward[i], backward[i], ((float) i) / (n - 1));
+        }
+        float error = 0;
+        for (int s = 0; s <= LOD_SAMPLES; s++) {
+            float t = ((float) s) / LOD_SAMPLES;
+            error = max(error, distance2(bezier_points(t, original, bez->size), bezier_points(t, reduced, n)));
+        }
+        if (error > tolerance) {
+            break;
+        }
+        memcpy(current, reduced, n * sizeof(Vec2));
+        size = n;
+    }
+    if (size == bez->size) {
+        return 0;
+    }
+
+    // The end points stay, the inner points left over are released
+    Geom* last = bez->points[bez->size - 1];
+    for (size_t i = size - 1; i + 1 < bez->size; i++) {
+        refs[bez->points[i] - layer->geoms]--;
+    }
+    for (size_t i = 1; i + 1 < size; i++) {
+        bez->points[i]->point.v = current[i];
+    }
+    bez->points[size - 1] = last;
+    bez->size = size;
+    if (size == 2 && same_color(bez->points[0], last)) {
+        g->type = SEGMENT;
+        g->segment.a = bez->points[0];
+        g->segment.b = last;
+        lod_set_bbox(g);
+        return 1;
+    }
+    bez->lut_state = LUT_NONE;
+    lod_set_bbox(g);
+    return 1;
+}
+
+// The segment after s in a chain through joint, when the joint is shared by the two segments only
+static Geom* lod_next_segment(Layer* layer, Geom* s, Geom* joint, const int* refs, const char* changed, const char* keep) {
+    size_t j = joint - layer->geoms;
+    if (refs[j] != 2) {
+        return NULL;
+    }
+    for (size_t i = j + 1; i < layer->size; i++) {
+        Geom* t = &(layer->geoms[i]);
+        if (t != s && keep[i] && t->type == SEGMENT && (t->segment.a == joint || t->segment.b == joint)) {
+            return (!changed[i] && t->round_r == s->round_r && same_color(t->segment.a, t->segment.b)) ? t : NULL;
+        }
+    }
+    return NULL;
+}
+
+// Merge the chain of segments through s into one, while the removed joints are within tolerance of it.
+// The whole chain has one color, so the gradients do not change.
+static void lod_merge_segments(Layer* layer, Geom* s, float tolerance, int* refs, char* changed, char* keep) {
+    if (!same_color(s->segment.a, s->segment.b)) {
+        return;
+    }
+    Geom* ends[2] = {s->segment.a, s->segment.b};
+    Geom* joints[LOD_MAX_CHAIN];
+    Geom* slot = s; // The merged segment is stored after all its points, in the last geom of the chain
+    size_t count = 0;
+    for (int side = 0; side < 2; side++) {
+        Geom* current = s;
+        while (count < LOD_MAX_CHAIN) {
+            Geom* joint = ends[side];
+            Geom* t = lod_next_segment(layer, current, joint, refs, changed, keep);
+            if (t == NULL) {
+                break;
+            }
+            Geom* end = (t->segment.a == joint) ? t->segment.b : t->segment.a;
+            if (end == ends[1 - side] || !same_color(end, s->segment.a)) {
+                break;
+            }
+            Vec2 a = (side == 0) ? end->point.v : ends[0]->point.v;
+            Vec2 b = (side == 0) ? ends[1]->point.v : end->point.v;
+            int aligned = distanceSegment2(joint->point.v, a, b) <= tolerance;
+            for (size_t k = 0; aligned && k < count; k++) {
+                aligned = distanceSegment2(joints[k]->point.v, a, b) <= tolerance;
+            }
+            if (!aligned) {
+                break;
+            }
+            joints[count++] = joint;
+            refs[joint - layer->geoms] -= 2;
+            keep[t - layer->geoms] = 0;
+            slot = (t > slot) ? t : slot;
+            ends[side] = end;
+            current = t;
+        }
+    }
+    if (count == 0) {
+        return;
+    }
+    keep[s - layer->geoms] = 0;
+    keep[slot - layer->geoms] = 1;
+    changed[slot - layer->geoms] = 1;
+    slot->round_r = s->round_r;
+    slot->segment.a = ends[0];
+    slot->segment.b = ends[1];
+    lod_set_bbox(slot);
+}
+
+static int compare_lod_point(const void* a, const void* b) {
+    const LodPoint* pa = a;
+    const LodPoint* pb = b;
+    if (pa->cy != pb->cy) {
+        return (pa->cy > pb->cy) - (pa->cy < pb->cy);
+    }
+    return (pa->cx > pb->cx) - (pa->cx < pb->cx);
+}
+
+// Merge the sub pixel points sharing a cell of the grid into one point, of the same total area and the average color.
+// The cell diagonal is tolerance, so no point moves farther.
+static void lod_merge_points(Layer* layer, float tolerance, const int* refs, char* changed, char* keep) {
+    LodPoint points[MAX_GEOMS_PER_LAYER];
+    size_t count = 0;
+    float cell = tolerance / M_SQRT2;
+    for (size_t j = 0; j < layer->size; j++) {
+        Geom* g = &(layer->geoms[j]);
+        if (keep[j] && !changed[j] && g->type == POINT && refs[j] == 0 && g->round_r > 0 && g->round_r < 0.5) {
+            points[count++] = (LodPoint){(long) floorf(g->point.v.x / cell), (long) floorf(g->point.v.y / cell), j};
+        }
+    }
+    qsort(points, count, sizeof(LodPoint), &compare_lod_point);
+
+    for (size_t first = 0, last; first < count; first = last) {
+        for (last = first + 1; last < count && compare_lod_point(&points[first], &points[last]) == 0; last++) {}
+        if (last - first < 2) {
+            continue;
+        }
+        Vec2 center = {0, 0};
+        float rgba[4] = {0, 0, 0, 0};
+        float area = 0;
+        for (size_t k = first; k < last; k++) {
+            Geom* g = &(layer->geoms[points[k].index]);
+            float w = g->round_r * g->round_r;
+            center = add2(center, mul2(g->point.v, w));
+            for (int c = 0; c < 4; c++) {
+                rgba[c] += g->point.rgba[c] * w;
+            }
+            area += w;
+            keep[points[k].index] = 0;
+        }
+        Geom* blob = &(layer->geoms[points[first].index]);
+        blob->point.v = mul2(center, 1 / area);
+        for (int c = 0; c < 4; c++) {
+            blob->point.rgba[c] = rgba[c] / area;
+        }
+        blob->round_r = sqrtf(area);
+        lod_set_bbox(blob);
+        keep[points[first].index] = 1;
+        changed[points[first].index] = 1;
+    }
+}
+
+// Simplify the scene, when the details below tolerance pixels do not matter, like for thumbnails. Call after read_scene.
+// The shapes move by tolerance at most, a geom goes through one of the changes only:
+//     segments and Beziers smaller than tolerance become points,
+//     Beziers get a lower degree,
+//     chains of aligned segments become one segment,
+//     sub pixel points close to each other become one point.
+// Then the points not visible are dropped, or hidden from the render when still referenced.
+// Layers using the smooth min are left as they are, each geom change their blend.
+// So are the geoms with domain operators, their points are not in the same place as their copies.
+// Return how many geoms were removed.
+extern size_t simplify_scene(Scene* scene, float tolerance) {
+    double start = trace_now();
+    int refs[MAX_GEOMS_PER_LAYER];
+    char keep[MAX_GEOMS_PER_LAYER];
+    char changed[MAX_GEOMS_PER_LAYER];
+    size_t removed = 0;
+    for (size_t i = 0; i < scene->size; i++) {
+        Layer* layer = &(scene->layer[i]);
+        if (layer->fusion != F_MIN) {
+            continue;
+        }
+        memset(refs, 0, sizeof(refs));
+        memset(keep, 1, layer->size);
+        for (size_t j = 0; j < layer->size; j++) {
+            changed[j] = (layer->geoms[j].domain_size > 0);
+        }
+        for (size_t j = 0; j < layer->size; j++) {
+            add_references(layer, &(layer->geoms[j]), refs, 1);
+        }
+
+        for (size_t j = 0; j < layer->size; j++) {
+            Geom* g = &(layer->geoms[j]);
+            if (g->type == SEGMENT || g->type == BEZIER) {
+                changed[j] = lod_shrink(layer, g, tolerance, refs);
+            }
+        }
+        for (size_t j = 0; j < layer->size; j++) {
+            if (!changed[j] && layer->geoms[j].type == BEZIER) {
+                changed[j] = lod_reduce_bezier(layer, &(layer->geoms[j]), tolerance, refs);
+            }
+        }
+        for (size_t j = 0; j < layer->size; j++) {
+            if (!changed[j] && keep[j] && layer->geoms[j].type == SEGMENT) {
+                lod_merge_segments(layer, &(layer->geoms[j]), tolerance, refs, changed, keep);
+            }
+        }
+        lod_merge_points(layer, tolerance, refs, changed, keep);
+
+        // A point without radius is never inside, its only use is as a reference
+        for (size_t j = 0; j < layer->size; j++) {
+            Geom* g = &(layer->geoms[j]);
+            if (keep[j] && g->type == POINT && g->round_r <= 0) {
+                if (refs[j] == 0) {
+                    keep[j] = 0;
+                } else {
+                    g->type = CONTROL;
+                }
+            }
+        }
+        size_t size = layer->size;
+        compact_layer(layer, keep);
+        removed += size - layer->size;
+        set_bbox_layer(layer);
+    }
+    trace_span("simplify", -1, start);
+    return removed;
+}
+/* === */
+
+/* Cost estimation */
+
+// Rough cost in nanoseconds of each part of the render, measured with -O3 on a x86-64 core
+#define COST_NS_PIXEL 20.0 // Per evaluated pixel, outside of the layers
+#define COST_NS_LAYER 4.0 // Per evaluated pixel and layer
+#define COST_NS_POINT 2.5
+#define COST_NS_SEGMENT 6.0
+#define COST_NS_BEZIER_LUT 3.0 // Per LUT entry
+#define COST_NS_BEZIER_TERM 3.0 // Per De Casteljau step, for each Newton iteration
+#define COST_NS_CULL 1.5 // Per geom left out by its bbox
+#define COST_NS_INSTANCE 4.0 // Moving the pixel in the group space, its geoms cost as segments
+#define COST_NS_SMOOTH_MIN 6.0
+#define COST_BAND 2.0 // Width in pixels on each side of an edge, where the pixels are all evaluated
+#define COST_MIN_NS_PER_WORKER 20e6 // Below this, another worker cost more than it save
+
+// Area of the bbox, grown by margin, inside the region
+static double region_area(Bbox b, float margin, Bbox region) {
+    double w = min(b.ur.x + margin, region.ur.x) - max(b.bl.x - margin, region.bl.x);
+    double h = min(b.ur.y + margin, region.ur.y) - max(b.bl.y - margin, region.bl.y);
+    return (w > 0 && h > 0) ? w*h : 0;
+}
+
+// Copies drawn by the domain operators of a geom, and copies evaluated at each of its pixels
+static double domain_copies(Layer* layer, Geom* g, double* evaluated) {
+    double copies = 1;
+    *evaluated = 1;
+    for (int i = 0; i < g->domain_size; i++) {
+        DomainOp* op = &(layer->domains[g->domain_first + i]);
+        if (op->type == DOMAIN_MIRROR) {
+            copies *= 2;
+            *evaluated *= (op->side == 0) ? 2 : 1;
+            continue;
+        }
+        for (int a = 0; a < 2; a++) {
+            copies *= op->last[a] - op->first[a] + 1;
+            *evaluated *= (op->last[a] > op->first[a]) ? 2 : 1;
+        }
+    }
+    return copies;
+}
+
+// Inside area and edge length of a geom, in its own units
+static void geom_shape(Layer* layer, Geom* g, double* inside, double* edge) {
+    float r = g->round_r;
+    double length = 0;
+    *inside = 0;
+    *edge = 0;
+    switch (g->type)
+    {
+    case SEGMENT:
+        length = distance2(g->segment.a->point.v, g->segment.b->point.v);
+        break;
+    case BEZIER:
+        use_bezier_lut(&(g->bezier));
+        for (int i = 1; i < g->bezier.lut_size; i++) {
+            length += distance2(g->bezier.lut[i-1], g->bezier.lut[i]);
+        }
+        break;
+    case POLYLINE:
+        for (size_t i = 1; i < g->polyline.size; i++) {
+            length += distance2(g->polyline.vertices[i-1].point.v, g->polyline.vertices[i].point.v);
+        }
+        break;
+    case POLYGON:
+        // Its area, and the outline, on one side only
+        for (size_t i = 1; i < g->polygon.outline.size; i++) {
+            Vec2 a = g->polygon.outline.vertices[i-1].point.v;
+            Vec2 b = g->polygon.outline.vertices[i].point.v;
+            length += distance2(a, b);
+            *inside += (a.x*b.y - b.x*a.y) / 2;
+        }
+        *inside = fabs(*inside) + length*r + M_PI*r*r;
+        *edge = length + 2*M_PI*r;
+        break;
+    case INSTANCE:
+        // The shapes of the group, scaled, the rounding of the instance is left out
+        for (size_t i = 0; i < g->instance.group->size; i++) {
+            double child_inside, child_edge;
+            geom_shape(g->instance.group, &(g->instance.group->geoms[i]), &child_inside, &child_edge);
+            *inside += child_inside * g->instance.scale * g->instance.scale;
+            *edge += child_edge * g->instance.scale;
+        }
+        break;
+    default:
+        break;
+    }
+    if (g->type != INSTANCE && g->type != POLYGON) {
+        *inside = length*2*r + M_PI*r*r;
+        *edge = 2*length + 2*M_PI*r;
+    }
+    double evaluated;
+    double copies = domain_copies(layer, g, &evaluated);
+    *inside *= copies;
+    *edge *= copies;
+}
+
+// Pixels evaluated around a geom: its inside, the band along its edge, and the steps taken by the skipping when approaching it
+static double geom_footprint(Layer* layer, Geom* g, Bbox region, double* band) {
+    double area = region_area(g->bbox, 0, region);
+    if (area <= 0) {
+        return 0;
+    }
+    double inside, edge;
+    geom_shape(layer, g, &inside, &edge);
+    double visible = area / ((g->bbox.ur.x - g->bbox.bl.x) * (g->bbox.ur.y - g->bbox.bl.y)); // Only count the part inside the region
+    double rows = min(g->bbox.ur.y, region.ur.y) - max(g->bbox.bl.y, region.bl.y);
+    *band += visible * COST_BAND * 2 * edge;
+    return visible * (inside + COST_BAND * 2 * edge) + rows*log2(region.ur.x - region.bl.x + 1);
+}
+
+// Estimate the cost of rendering a region of the scene, from the kind, size and place of its geometries
+static void estimate_region_cost(Scene* scene, Bbox region, RenderCost* cost) {
+    memset(cost, 0, sizeof(RenderCost));
+    double area = (region.ur.x - region.bl.x) * (region.ur.y - region.bl.y);
+    double ns = 0;
+
+    // Pixels evaluated in each layer, then in the whole scene
+    double evaluated[MAX_LAYER];
+    double scene_evaluated = (region.ur.y - region.bl.y) * log2(region.ur.x - region.bl.x + 1);
+    for (size_t i = 0; i < scene->size; i++) {
+        Layer* layer = &(scene->layer[i]);
+        double layer_area = region_area(layer->bbox, 0, region);
+        double footprint = 0;
+        for (size_t j = 0; j < layer->size; j++) {
+            footprint += geom_footprint(layer, &(layer->geoms[j]), region, &(cost->band_pixels));
+        }
+        cost->bbox_pixels += layer_area;
+        evaluated[i] = min(layer_area, footprint);
+        scene_evaluated += evaluated[i];
+    }
+    scene_evaluated = min(scene_evaluated, area);
+    cost->evaluated_pixels = scene_evaluated;
+    ns += scene_evaluated * (COST_NS_PIXEL + scene->size * COST_NS_LAYER);
+
+    for (size_t i = 0; i < scene->size; i++) {
+        Layer* layer = &(scene->layer[i]);
+        double layer_area = region_area(layer->bbox, 0, region);
+        double density = (layer_area > 0) ? min(1.0, evaluated[i] / layer_area) : 0;
+        cost->smooth_layers += (layer->fusion == F_SMIN);
+        if (layer->fusion == F_SMIN) {
+            cost->smooth_min_blends += evaluated[i] * layer->size;
+            ns += evaluated[i] * layer->size * COST_NS_SMOOTH_MIN;
+        }
+        for (size_t j = 0; j < layer->size; j++) {
+            Geom* g = &(layer->geoms[j]);
+            double evals = 0;
+            int iterations = 0;
+            double copies_evaluated;
+            domain_copies(layer, g, &copies_evaluated);
+            int grid;
+            double edges;
+            double geom_ns = ns;
+            switch (g->type)
+            {
+            case POINT:
+                cost->points++;
+                evals = (g->domain_size == 0) ? evaluated[i] : density * region_area(g->bbox, _params.cull_margin, region); // Else never left out by its bbox
+                ns += evals * COST_NS_POINT;
+                break;
+            case SEGMENT:
+                cost->segments++;
+                evals = density * region_area(g->bbox, _params.cull_margin, region);
+                ns += evals * COST_NS_SEGMENT;
+                break;
+            case BEZIER:
+                cost->beziers++;
+                cost->bezier_points += g->bezier.size;
+                evals = density * region_area(g->bbox, _params.cull_margin, region);
+                iterations = (_params.bezier_solver == BEZIER_SOLVER_NEWTON) ? _params.bezier_max_iterations : 0;
+                ns += evals * (g->bezier.lut_size*COST_NS_BEZIER_LUT + iterations * g->bezier.size*g->bezier.size * COST_NS_BEZIER_TERM);
+                break;
+            case INSTANCE:
+                cost->instances++;
+                evals = density * region_area(g->bbox, _params.cull_margin, region);
+                ns += evals * (COST_NS_INSTANCE + g->instance.group->size * COST_NS_SEGMENT);
+                break;
+            case POLYLINE:
+                cost->polylines++;
+                cost->polyline_points += g->polyline.size;
+                evals = density * region_area(g->bbox, _params.cull_margin, region);
+                ns += evals * ((g->polyline.size / POLYLINE_CHUNK + 1) * COST_NS_CULL + POLYLINE_CHUNK * COST_NS_SEGMENT); // Mostly one chunk evaluated
+                break;
+            case POLYGON:
+                cost->polygons++;
+                cost->polygon_points += g->polygon.outline.size - 1;
+                evals = density * region_area(g->bbox, _params.cull_margin, region);
+                grid = g->polygon.grid;
+                // With a grid, about a row and a few cells
+                edges = (grid == 0) ? g->polygon.outline.size - 1 : 4.0 * g->polygon.buckets[grid*grid + grid*POLYGON_ROWS_PER_CELL] / (grid*grid + grid);
+                ns += evals * edges * COST_NS_SEGMENT;
+                break;
+            default:
+                break;
+            }
+            ns = geom_ns + (ns - geom_ns) * copies_evaluated;
+            if (g->type != POINT || g->domain_size > 0) {
+                ns += (evaluated[i] - evals) * COST_NS_CULL;
+            }
+            cost->sdf_evaluations += evals;
+        }
+    }
+
+    if (_params.antialiasing == AA_SUPERSAMPLE) {
+        ns *= 4; // Roughly, the samples of a pixel are evaluated the same
+    }
+    cost->seconds = ns * 1e-9;
+    cost->workers = clamp((size_t) (ns / COST_MIN_NS_PER_WORKER), 1, 1024);
+}
+
+extern void estimate_render_cost(Scene* scene, size_t canvas_width, size_t canvas_height, RenderCost* cost) {
+    estimate_region_cost(scene, (Bbox){{0, 0}, {canvas_width, canvas_height}}, cost);
+}
+/* === */
+
+/* Statistics */
+
+// Add the counters of the calling thread to the total
+static void merge_thread_stats() {
+#ifdef RENDER_STATS
+    unsigned long* total = (unsigned long*) &_stats;
+    unsigned long* local = (unsigned long*) &_thread_stats;
+    pthread_mutex_lock(&_stats_lock);
+    for (size_t i = 0; i < sizeof(RenderStats) / sizeof(unsigned long); i++) {
+        total[i] += local[i];
+    }
+    pthread_mutex_unlock(&_stats_lock);
+    memset(&_thread_stats, 0, sizeof(RenderStats));
+#endif
+}
+
+// Counters summed over the renders since the last reset. Return E_STATS_DISABLED when not compiled with RENDER_STATS.
+extern int get_render_stats(RenderStats* stats) {
+#ifdef RENDER_STATS
+    pthread_mutex_lock(&_stats_lock);
+    *stats = _stats;
+    pthread_mutex_unlock(&_stats_lock);
+    return OK;
+#else
+    memset(stats, 0, sizeof(RenderStats));
+    return E_STATS_DISABLED;
+#endif
+}
+
+extern void reset_render_stats() {
+#ifdef RENDER_STATS
+    pthread_mutex_lock(&_stats_lock);
+    memset(&_stats, 0, sizeof(RenderStats));
+    pthread_mutex_unlock(&_stats_lock);
+#endif
+}
+
+/* Heatmap, see RENDER_HEATMAP */
+#ifdef RENDER_STATS
+#define HEATMAP_DECADES 4 // The scale goes from 1 to 10^HEATMAP_DECADES
+#define HEATMAP_LEGEND_HEIGHT 12
+static const float HEATMAP_SKIPPED[3] = {0.2, 0.2, 0.2};
+static const float HEATMAP_RAMP[5][3] = {{0, 0, 0.4}, {0, 0.6, 1}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0}};
+
+// Work done by the thread since its start, in exact evaluations and Newton iterations
+static inline unsigned long pixel_cost() {
+    return _thread_stats.point_evaluations + _thread_stats.segment_evaluations + _thread_stats.bezier_evaluations + _thread_stats.newton_iterations;
+}
+
+// Color of t, from 0 to 1, on the heat ramp
+static void heatmap_ramp(float t, float pixel[3]) {
+    float pos = clamp(t, 0.0f, 1.0f) * 4;
+    int i = min((int) pos, 3);
+    float a = pos - i;
+    pixel[0] = mix(HEATMAP_RAMP[i][0], HEATMAP_RAMP[i+1][0], a);
+    pixel[1] = mix(HEATMAP_RAMP[i][1], HEATMAP_RAMP[i+1][1], a);
+    pixel[2] = mix(HEATMAP_RAMP[i][2], HEATMAP_RAMP[i+1][2], a);
+}
+
+static void heatmap_color(unsigned long cost, float pixel[3]) {
+    heatmap_ramp(log10f(cost + 1) / HEATMAP_DECADES, pixel);
+}
+
+// The scale along the bottom of the canvas, with a white tick on each power of 10
+static void heatmap_legend(size_t x, size_t width, float pixel[3]) {
+    float t = ((float) x) / width;
+    float next_t = ((float) x + 1) / width;
+    heatmap_ramp(t, pixel);
+    if (floorf(t * HEATMAP_DECADES) != floorf(next_t * HEATMAP_DECADES)) {
+        pixel[0] = pixel[1] = pixel[2] = 1;
+    }
+}
+#endif
+
+// Time each exact evaluation, and account it to its geom, see get_geom_profile. Return E_STATS_DISABLED without RENDER_STATS.
+extern int set_geom_profiling(int enabled) {
+#ifdef RENDER_STATS
+    if (enabled) {
+        // Smallest time between two clock reads, removed from each measure
+        _profile_overhead = ULONG_MAX;
+        for (int i = 0; i < 1000; i++) {
+            unsigned long start = profile_clock();
+            _profile_overhead = min(_profile_overhead, profile_clock() - start);
+        }
+    }
+    _profiling = enabled;
+    return OK;
+#else
+    return enabled ? E_STATS_DISABLED : OK;
+#endif
+}
+
+#ifdef RENDER_STATS
+static int compare_profile_time(const void* a, const void* b) {
+    unsigned long ta = ((GeomProfile*) a)->ns;
+    unsigned long tb = ((GeomProfile*) b)->ns;
+    return (ta < tb) - (ta > tb);
+}
+#endif
+
+// Fill profiles with the max most expensive geoms of the scene, since it was read. Return how many were filled.
+extern size_t get_geom_profile(Scene* scene, GeomProfile* profiles, size_t max) {
+    size_t count = 0;
+#ifdef RENDER_STATS
+    for (size_t i = 0; i < scene->size; i++) {
+        count += scene->layer[i].size;
+    }
+    GeomProfile* all = malloc(sizeof(GeomProfile) * count);
+    if (all == NULL) {
+        return 0;
+    }
+    count = 0;
+    for (size_t i = 0; i < scene->size; i++) {
+        for (size_t j = 0; j < scene->layer[i].size; j++) {
+            Geom* g = &(scene->layer[i].geoms[j]);
+            all[count++] = (GeomProfile){g->line, i, j, g->profile_evaluations, g->profile_ns};
+        }
+    }
+    qsort(all, count, sizeof(GeomProfile), &compare_profile_time);
+    count = min(count, max);
+    memcpy(profiles, all, sizeof(GeomProfile) * count);
+    free(all);
+#endif
+    return count;
+}
+
+/* Quality presets */
+
+static const char* PRESET_NAMES[PRESETS] = {"draft", "balanced", "final"};
+static const RenderParams PRESET_PARAMS[PRESETS] = {
+    {15, 0, 1e-4, BEZIER_SOLVER_POLYLINE, 1.5, 3, AA_NONE, 1},
+    {31, 10, 1e-6, BEZIER_SOLVER_NEWTON, 1.5, 7.5, AA_LINEAR, 1},
+    {63, 20, 1e-7, BEZIER_SOLVER_NEWTON, 1.5, 12, AA_SUPERSAMPLE, 1},
+};
+
+// Return the preset of that name, or -1
+extern int find_render_preset(const char* name) {
+    for (int i = 0; i < PRESETS; i++) {
+        if (strcmp(name, PRESET_NAMES[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+extern int get_render_preset(int preset, RenderParams* params) {
+    if (preset < 0 || preset >= PRESETS) {
+        return E_INVALID_PARAMS;
+    }
+    *params = PRESET_PARAMS[preset];
+    return OK;
+}
+
+// Used by the next read_scene for the Bezier LUT, by the next renders for the others
+extern int set_render_params(const RenderParams* params) {
+    if (params->bezier_lut_size < 2 || params->bezier_lut_size > MAX_BEZIER_LUT_SIZE
+        || params->bezier_max_iterations < 0 || params->smooth_min_factor <= 0
+        || params->cull_margin < 0 || params->skip_factor <= 0) {
+        LOG_E("Invalid render params, LUT size %d (2 to %d)", params->bezier_lut_size, MAX_BEZIER_LUT_SIZE);
+        return E_INVALID_PARAMS;
+    }
+    _params = *params;
+    return OK;
+}
+
+extern void get_render_params(RenderParams* params) {
+    *params = _params;
+}
+/* === */
+
+// Choose what the pixels show, see "Render modes". Return E_STATS_DISABLED for the modes needing RENDER_STATS.
+extern int set_render_mode(int mode) {
+#ifndef RENDER_STATS
+    if (mode == RENDER_HEATMAP) {
+        return E_STATS_DISABLED;
+    }
+#endif
+    _render_mode = mode;
+    return OK;
+}
+/* === */
+
+// Stop the render in progress at the end of the current row. Can be called from the pixel callback.
+extern void cancel_render() {
+    _cancelled = 1;
+}
+
+static int render_rect(Scene* scene, size_t x0, size_t y0, size_t x1, size_t y1, CallbackPixel handle_pixel) {
+    for (size_t y = y0; y < y1; y++) {
+        if (_cancelled) {
+            return E_RENDER_CANCELLED;
+        }
+        double row_start = trace_now();
+        size_t next_pixel = x0;
+        float last_distance = 0;
+        for (size_t x = x0; x < x1; x++) {
+            float pixel[3] = {0, 0, 0};
+            if (_render_mode == RENDER_REFERENCE) {
+                refRenderScene(scene, x, y, pixel);
+            } else if (x >= next_pixel) { // Simple optimization, since we know the distance to the next pixel
+                STAT(evaluated_pixels, 1);
+#ifdef RENDER_STATS
+                unsigned long cost = pixel_cost();
+#endif
+                sdRenderPixel(scene, x, y, pixel, &last_distance);
+                next_pixel = x + (int)clamp(last_distance * _params.skip_factor, 0, x1);
+#ifdef RENDER_STATS
+                if (_render_mode == RENDER_HEATMAP) {
+                    heatmap_color(pixel_cost() - cost, pixel);
+                }
+#endif
+            } else {
+                STAT(skipped_pixels, 1);
+#ifdef RENDER_STATS
+                if (_render_mode == RENDER_HEATMAP) {
+                    copy3(pixel, HEATMAP_SKIPPED);
+                }
+#endif
+            }
+#ifdef RENDER_STATS
+            if (_render_mode == RENDER_HEATMAP && y < HEATMAP_LEGEND_HEIGHT) {
+                heatmap_legend(x, scene->canvas_width, pixel);
+            }
+#endif
+            handle_pixel(x, y, pixel);
+        }
+        trace_span("row", y, row_start);
+    }
+    return OK;
+}
+
+// Render the region [x0, x1[ x [y0, y1[ of the scene, and write the resulting pixel one by one using the handle_pixel callback.
+// Rendering whole rows give the same pixels as render_canvas.
+extern int render_region(Scene* scene, size_t x0, size_t y0, size_t x1, size_t y1, CallbackPixel handle_pixel) {
+    _cancelled = 0;
+    phase(PHASE_RENDER, 1);
+    int res = render_rect(scene, x0, y0, x1, y1, handle_pixel);
+    phase(PHASE_RENDER, 0);
+    merge_thread_stats();
+    return res;
+}
+
+/* Progressive rendering, see render_progressive */
+
+#define PASS_STEP(PASS) (8 >> (PASS)) // Between the samples of a pass
+
+// Tell if the pixel (x, y) of the pass can be skipped, from the distances of the samples already rendered around it:
+// the ones of the previous passes at the corners of its cell, and its neighbors on the left and below in this pass.
+// Skipped as by render_rect, bound is set to a lower bound of its own distance.
+static int seeded_skip(float* seeds, size_t w, size_t h, size_t x, size_t y, int pass, float* bound) {
+    size_t step = PASS_STEP(pass);
+    size_t cell = 2*step;
+    size_t cx = x - x % cell;
+    size_t cy = y - y % cell;
+    size_t candidates[6][2] = {{x - step, y}, {x, y - step}, {cx, cy}, {cx + cell, cy}, {cx, cy + cell}, {cx + cell, cy + cell}};
+    size_t count = (pass == 0) ? 2 : 6; // The first pass has no cells
+    int skip = 0;
+    *bound = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t qx = candidates[i][0];
+        size_t qy = candidates[i][1];
+        if (qx >= w || qy >= h || (qx == x && qy == y)) {
+            continue; // Out of the canvas, wrapped around below 0 included
+        }
+        float d = seeds[qy*w + qx];
+        float dx = (float) qx - x;
+        float dy = (float) qy - y;
+        float r = sqrtf(dx*dx + dy*dy);
+        if (d > 0 && r < (int) min(d * _params.skip_factor, w + h)) {
+            skip = 1;
+            *bound = max(*bound, d - r);
+        }
+    }
+    return skip;
+}
+
+// Render the pass of a progressive render, see render_progressive. seeds holds one float per pixel, written by
+// each pass and read by the next ones, so keep it between the passes.
+extern int render_pass(Scene* scene, size_t canvas_width, size_t canvas_height, int pass, float* seeds, CallbackPixel handle_pixel) {
+    if (pass < 0 || pass >= PROGRESSIVE_PASSES) {
+        LOG_E("Bad pass %d", pass);
+        return E_INVALID_PARAMS;
+    }
+    _cancelled = 0;
+    phase(PHASE_RENDER, 1);
+    int res = OK;
+    size_t step = PASS_STEP(pass);
+    for (size_t y = 0; y < canvas_height; y += step) {
+        if (_cancelled) {
+            res = E_RENDER_CANCELLED;
+            break;
+        }
+        double row_start = trace_now();
+        for (size_t x = 0; x < canvas_width; x += step) {
+            if (pass > 0 && x % (2*step) == 0 && y % (2*step) == 0) {
+                continue; // Sample of a previous pass
+            }
+            float pixel[3] = {0, 0, 0};
+            float d = 0;
+            if (_render_mode == RENDER_REFERENCE) {
+                refRenderScene(scene, x, y, pixel);
+            } else if (seeded_skip(seeds, canvas_width, canvas_height, x, y, pass, &d)) {
+                STAT(skipped_pixels, 1);
+            } else {
+                STAT(evaluated_pixels, 1);
+                sdRenderPixel(scene, x, y, pixel, &d);
+            }
+            seeds[y*canvas_width + x] = d;
+            // The sample stands for its block, until the next passes refine it
+            for (size_t by = y; by < min(y + step, canvas_height); by++) {
+                for (size_t bx = x; bx < min(x + step, canvas_width); bx++) {
+                    handle_pixel(bx, by, pixel);
+                }
+            }
+        }
+        trace_span("row", y, row_start);
+    }
+    phase(PHASE_RENDER, 0);
+    merge_thread_stats();
+    return res;
+}
+
+extern int render_progressive(Scene* scene, size_t canvas_width, size_t canvas_height, CallbackPixel handle_pixel, CallbackPass handle_pass) {
+    float* seeds = malloc(sizeof(float) * canvas_width * canvas_height);
+    if (seeds == NULL) {
+        return E_ALLOC;
+    }
+    int res = OK;
+    for (int pass = 0; pass < PROGRESSIVE_PASSES && res == OK; pass++) {
+        double pass_start = trace_now();
+        res = render_pass(scene, canvas_width, canvas_height, pass, seeds, handle_pixel);
+        trace_span("pass", pass, pass_start);
+        if (res == OK && handle_pass) {
+            handle_pass(pass, 0, 0, canvas_width, canvas_height);
+        }
+    }
+    free(seeds);
+    return res;
+}
+/* === */
+
+/* Parallel rendering */
+
+#define TILE_SIZE 64
+#define MAX_TILES 4096 // Above, the tiles get bigger, to bound the scheduling cost
+
+typedef struct Tile {
+    size_t x0, y0, x1, y1;
+    double cost; // Estimated, in seconds
+} Tile;
+
+typedef struct TileQueue {
+    Scene* scene;
+    Tile* tiles; // Most expensive first
+    size_t size;
+    size_t next; // Next tile to take, shared by the threads
+    CallbackPixel handle_pixel;
+    int res;
+} TileQueue;
+
+static int compare_tile_cost(const void* a, const void* b) {
+    double ca = ((Tile*) a)->cost;
+    double cb = ((Tile*) b)->cost;
+    return (ca < cb) - (ca > cb);
+}
+
+// Each thread take the next most expensive tile as soon as it is done with the previous one
+static void* render_tiles_worker(void* arg) {
+    TileQueue* queue = arg;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&(queue->next), 1, __ATOMIC_RELAXED);
+        if (i >= queue->size) {
+            break;
+        }
+        Tile* t = &(queue->tiles[i]);
+        double tile_start = trace_now();
+        int res = render_rect(queue->scene, t->x0, t->y0, t->x1, t->y1, queue->handle_pixel);
+        trace_span("tile", i, tile_start);
+        if (res != OK) {
+            queue->res = E_RENDER_CANCELLED;
+            break;
+        }
+    }
+    merge_thread_stats();
+    return NULL;
+}
+
+// Render the scene with threads, in tiles scheduled from the most to the least expensive.
+// handle_pixel is called concurrently, for distinct pixels.
+extern int render_tiles(Scene* scene, size_t canvas_width, size_t canvas_height, size_t threads, CallbackPixel handle_pixel) {
+    size_t tile_size = TILE_SIZE;
+    while (((canvas_width + tile_size - 1) / tile_size) * ((canvas_height + tile_size - 1) / tile_size) > MAX_TILES) {
+        tile_size *= 2;
+    }
+    size_t columns = (canvas_width + tile_size - 1) / tile_size;
+    size_t rows = (canvas_height + tile_size - 1) / tile_size;
+
+    phase(PHASE_RENDER, 1);
+    double schedule_start = trace_now();
+    TileQueue queue = {scene, malloc(sizeof(Tile) * columns * rows), columns * rows, 0, handle_pixel, OK};
+    if (queue.tiles == NULL) {
+        phase(PHASE_RENDER, 0);
+        return E_ALLOC;
+    }
+    for (size_t i = 0; i < queue.size; i++) {
+        Tile* t = &(queue.tiles[i]);
+        t->x0 = (i % columns) * tile_size;
+        t->y0 = (i / columns) * tile_size;
+        t->x1 = min(t->x0 + tile_size, canvas_width);
+        t->y1 = min(t->y0 + tile_size, canvas_height);
+        RenderCost cost;
+        estimate_region_cost(scene, (Bbox){{t->x0, t->y0}, {t->x1, t->y1}}, &cost);
+        t->cost = cost.seconds;
+    }
+    qsort(queue.tiles, queue.size, sizeof(Tile), &compare_tile_cost);
+    trace_span("schedule tiles", -1, schedule_start);
+
+    _cancelled = 0;
+    threads = clamp(threads, 1, queue.size);
+    pthread_t* ids = malloc(sizeof(pthread_t) * threads);
+    size_t started = 0;
+    for (; ids && started < threads - 1; started++) {
+        if (pthread_create(&(ids[started]), NULL, &render_tiles_worker, &queue) != 0) {
+            break;
+        }
+    }
+    render_tiles_worker(&queue); // The calling thread works too
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    free(ids);
+    free(queue.tiles);
+    phase(PHASE_RENDER, 0);
+    return queue.res;
+}
+/* === */
+
+// Render the scene, and write the resulting pixel one by one using the handle_pixel callback
+extern int render_canvas(Scene* scene, size_t canvas_width, size_t canvas_height, CallbackPixel handle_pixel) {
+    return render_region(scene, 0, 0, canvas_width, canvas_height, handle_pixel);
+}
+
+extern int read_and_render(size_t canvas_width, size_t canvas_height, CallbackReadLine cb_readline, CallbackPixel cb_pixel, CallbackMessage cb_message) {
+    message_callback = cb_message;
+    int res = OK;
+
+    Scene* scene = create_scene();
+    if (scene == NULL) {
+        LOG_E("Failed to allocate scene of %ld bytes", sizeof(Scene));
+        return E_ALLOC;
+    }
+
+    res = read_scene(scene, canvas_width, canvas_height, cb_readline);
+    if (res == OK) {
+        res = render_canvas(scene, canvas_width, canvas_height, cb_pixel);
+    }
 
+    destroy_scene(scene);
     return res;
 }
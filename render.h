@@ -25,11 +25,188 @@
 #define E_PARSE_NUMBER -11
 #define E_PARSE_ISEGMENT_BAD_INDEX -12
 #define E_PARSE_NEED_LAYER -13
+#define E_PARSE_BAD_GROUP -14
+#define E_PARSE_BAD_DOMAIN -15
 #define E_RENDER_INVALID_COORD -30
+#define E_RENDER_CANCELLED -31
+#define E_ALLOC -40
+#define E_STATS_DISABLED -41
+#define E_INVALID_PARAMS -42
+#define E_UPDATE_UNSUPPORTED -43
+#define E_FILE_OPEN -50 // Of the programs reading and writing files
+
+#define MAX_PATH 4096 // Of the files written by the programs, built from an output name
 
 typedef void (*CallbackMessage)(char*);
 typedef void (*CallbackPixel)(int, int, float[3]);
 typedef int (CallbackReadLine(char**, size_t*));
+// Called with begin at 1 when a phase start, then at 0 when it ends
+typedef void (*CallbackPhase)(int phase, int begin);
+
+// Phases of the work
+#define PHASE_PARSE 0 // The instructions
+#define PHASE_INDEX 1 // The culling to the canvas, and the layer bboxes
+#define PHASE_RENDER 2
+
+typedef struct Scene Scene;
+
+// Parse once, render many times. The scene coordinates are tied to the canvas size given to read_scene,
+// and the geoms that cannot change a pixel of that canvas are dropped.
+extern Scene* create_scene();
+extern void destroy_scene(Scene* scene);
+extern void set_message_callback(CallbackMessage cb_message);
+extern void set_phase_callback(CallbackPhase cb_phase);
+extern int read_scene(Scene* scene, size_t canvas_width, size_t canvas_height, CallbackReadLine cb_readline);
+extern int render_canvas(Scene* scene, size_t canvas_width, size_t canvas_height, CallbackPixel cb_pixel);
+extern int render_region(Scene* scene, size_t x0, size_t y0, size_t x1, size_t y1, CallbackPixel cb_pixel);
+// Render with threads, cb_pixel is called concurrently for distinct pixels
+extern int render_tiles(Scene* scene, size_t canvas_width, size_t canvas_height, size_t threads, CallbackPixel cb_pixel);
+extern void cull_scene(Scene* scene, size_t x0, size_t y0, size_t x1, size_t y1);
+
+// Render coarse to fine, to show the scene early: a first pass samples every 8th pixel of each row and column, then each
+// pass halves the step, until every pixel is rendered. A sample is given for its whole block, upscaled, until the next
+// passes refine it; the samples are rendered once, and their distances skip the empty pixels of the next passes.
+// cb_pass is called after each pass, with the region of the canvas it updated (x0, y0, x1, y1). The heatmap is not drawn.
+#define PROGRESSIVE_PASSES 4
+typedef void (*CallbackPass)(int pass, size_t x0, size_t y0, size_t x1, size_t y1);
+extern int render_progressive(Scene* scene, size_t canvas_width, size_t canvas_height, CallbackPixel cb_pixel, CallbackPass cb_pass);
+// The passes one by one, for callers that must return between them, like the web page. seeds holds a float per pixel,
+// kept from a pass to the next. Run the passes in order, from 0.
+extern int render_pass(Scene* scene, size_t canvas_width, size_t canvas_height, int pass, float* seeds, CallbackPixel cb_pixel);
+
+// Build a scene from arrays instead of instructions, with the same units: coordinates and radius in fraction of the canvas.
+// Call begin_scene, add a layer then its geoms, and end_scene to complete the scene as read_scene would.
+// As in the instructions, a geom references the points of its layer by their index, in the order they were added.
+// The arrays are only read during the call. When a call fails, no geom is added. Each scene keeps its canvas, several
+// can be built at once.
+extern int begin_scene(Scene* scene, size_t canvas_width, size_t canvas_height);
+// Where fusion can be any of "Fusion types" (0 for min, 1 for smooth min)
+extern int scene_add_layer(Scene* scene, int fusion);
+// xy holds 2 floats per point. rgba 4 floats per point, or NULL for magenta. radius 1 float per point, or NULL for none.
+extern int scene_add_points(Scene* scene, size_t count, const float* xy, const float* rgba, const float* radius);
+// indexes holds 2 point indexes per segment. radius 1 float per segment, or NULL for none.
+extern int scene_add_segments(Scene* scene, size_t count, const int* indexes, const float* radius);
+// A polyline, or a filled polygon, through count points
+extern int scene_add_polyline(Scene* scene, size_t count, const int* indexes, float radius);
+extern int scene_add_polygon(Scene* scene, size_t count, const int* indexes, float radius);
+extern int end_scene(Scene* scene);
+
+// Animate a scene: change its points between renders, and render again only the pixels they can change.
+// read_animated_scene reads like read_scene, but keeps the geoms out of the canvas, as they may move in,
+// and the points keep the index of the instructions. The updates use the canvas of the last scene read.
+extern int read_animated_scene(Scene* scene, size_t canvas_width, size_t canvas_height, CallbackReadLine cb_readline);
+// Change the point index of a layer: its position, color and radius, each left as is when NULL. The segments and Beziers
+// using it follow, the polylines and polygons copied their points when read and do not. Geoms with domain operators
+// cannot be updated. dirty (x0, y0, x1, y1) grows to hold the pixels to render again, start with an empty one (all 0).
+extern int update_point(Scene* scene, size_t layer, size_t index, const float* xy, const float* rgba, const float* radius, size_t dirty[4]);
+
+// Parse again the instructions of a layer read by read_scene, its LAYER line first, leaving the other layers and the groups
+// as they are. The lines are numbered from first_line. dirty (x0, y0, x1, y1) grows to hold the pixels to render again,
+// see update_point. When it fails, the layer is left incomplete: read the whole scene again.
+extern int reread_layer(Scene* scene, size_t layer, size_t first_line, CallbackReadLine cb_readline, size_t dirty[4]);
+
+// Drop the details below tolerance pixels, for small renders like thumbnails. Return how many geoms were removed.
+extern size_t simplify_scene(Scene* scene, float tolerance);
+extern void cancel_render();
+
+// Rough estimate of the work needed to render a scene
+typedef struct RenderCost {
+    size_t points;
+    size_t segments;
+    size_t beziers;
+    size_t bezier_points; // Sum of the number of points of each Bezier, their cost grow with its square
+    size_t instances;
+    size_t polylines;
+    size_t polyline_points;
+    size_t polygons;
+    size_t polygon_points;
+    size_t smooth_layers; // Layers using the smooth min
+    double bbox_pixels; // Pixels inside a layer bbox, summed over the layers
+    double band_pixels; // Pixels along the geometries edges
+    double evaluated_pixels; // Pixels not skipped
+    double sdf_evaluations; // Exact distance evaluations
+    double smooth_min_blends;
+    double seconds; // Predicted render time, on one core
+    size_t workers; // Number of workers worth using
+} RenderCost;
+
+extern void estimate_render_cost(Scene* scene, size_t canvas_width, size_t canvas_height, RenderCost* cost);
+
+// Counters of the work done by the renders, only counted when render.c is compiled with -DRENDER_STATS.
+// All the fields are unsigned long, to be summed in a loop.
+typedef struct RenderStats {
+    unsigned long evaluated_pixels;
+    unsigned long skipped_pixels; // Known to be empty from the distance of the previous pixel
+    unsigned long layer_early_outs; // Pixels outside of a layer bbox, for each layer
+    unsigned long point_evaluations;
+    unsigned long segment_evaluations;
+    unsigned long bezier_evaluations;
+    unsigned long instance_evaluations; // Each one evaluates the geoms of the group, counted apart
+    unsigned long polyline_evaluations; // Each one evaluates the segments close to the pixel, counted as segment_evaluations
+    unsigned long polygon_evaluations; // Same, with the edges tested for the sign
+    unsigned long bbox_culls; // Geoms replaced by the distance to their bbox
+    unsigned long newton_iterations;
+    unsigned long newton_unconverged; // Bezier distances still imprecise after bezier_max_iterations
+    unsigned long smooth_min_blends;
+} RenderStats;
+
+extern int get_render_stats(RenderStats* stats);
+extern void reset_render_stats();
+
+// Render modes
+#define RENDER_COLOR 0 // The scene
+// Cost of each pixel, in exact evaluations plus Newton iterations, on a log scale from 1 (blue) to 10^4 (red).
+// Skipped pixels are gray. The scale is drawn along the bottom, with a white tick on each power of 10. Needs RENDER_STATS.
+#define RENDER_HEATMAP 1
+// Slow reference for the other optimizations: every geom evaluated at every pixel in double precision,
+// no skipping or culling, and a Bezier distance refined until convergence.
+#define RENDER_REFERENCE 2
+
+extern int set_render_mode(int mode);
+
+// Quality against speed. The params are global, set them before reading and rendering.
+typedef struct RenderParams {
+    int bezier_lut_size; // Samples of the Bezier curves, to start the solver from the closest, at most 63
+    int bezier_max_iterations; // Of Newton's method
+    float bezier_epsilon; // Newton's method stops when the step is below this fraction of the curve speed
+    int bezier_solver; // See "Bezier solvers"
+    float smooth_min_factor; // Size of the blend between the geoms of smooth min layers, in pixels. Changes the shapes.
+    float cull_margin; // Distance to the bbox, in pixels, above which a geom is not evaluated exactly
+    int antialiasing; // See "Antialiasing modes"
+    float skip_factor; // Fraction of the distance to the nearest geom skipped after a pixel. Above 1 thin geoms may be missed.
+} RenderParams;
+
+// Bezier solvers
+#define BEZIER_SOLVER_NEWTON 0 // From the closest sample, refined with Newton's method
+#define BEZIER_SOLVER_POLYLINE 1 // Distance to the polyline through the samples
+
+// Antialiasing modes
+#define AA_NONE 0
+#define AA_LINEAR 1 // Opacity ramp over the pixel at the edge
+#define AA_SUPERSAMPLE 2 // Linear, averaged over 2x2 samples per pixel
+
+// Presets
+#define PRESET_DRAFT 0 // For previews: coarse LUT, polyline Bezier, no antialiasing, narrow cull margin
+#define PRESET_BALANCED 1 // The default
+#define PRESET_FINAL 2 // Fine LUT, more Newton iterations, wider cull margin, supersampling
+#define PRESETS 3
+
+extern int find_render_preset(const char* name);
+extern int get_render_preset(int preset, RenderParams* params);
+extern int set_render_params(const RenderParams* params);
+extern void get_render_params(RenderParams* params);
+
+// Cost of one geom, see set_geom_profiling. Needs RENDER_STATS.
+typedef struct GeomProfile {
+    size_t line; // Instruction line of the geom, starting at 1
+    size_t layer;
+    size_t index; // In the layer
+    unsigned long evaluations; // Exact evaluations
+    unsigned long ns; // Time spent in them
+} GeomProfile;
+
+extern int set_geom_profiling(int enabled);
+extern size_t get_geom_profile(Scene* scene, GeomProfile* profiles, size_t max);
 
 extern int read_and_render(size_t canvas_width, size_t canvas_height, CallbackReadLine cb_readline, CallbackPixel cb_pixel, CallbackMessage cb_message);
 
@@ -0,0 +1,192 @@
+"""
+Build and render scenes from Python, through libsdf.so (see sdflib.c), without writing instructions.
+
+The arrays are passed to the library without copy: NumPy arrays must be C contiguous, float32 for the
+coordinates, colors and radius, int32 for the indexes. Other buffers (array.array, ...) work too.
+Coordinates and radius are in fraction of the canvas, as in the instructions.
+
+    scene = sdf.Scene(800, 800)
+    scene.layer()
+    first = scene.points(xy, rgba, radius)  # xy is N x 2, rgba N x 4, radius N
+    scene.segments(first + pairs, radius)   # pairs is M x 2, indexes of the points in the layer
+    image = scene.render(threads=4)         # height x width x 3 bytes, from the top row
+"""
+
+import ctypes
+import os
+import sys
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+_float_p = ctypes.POINTER(ctypes.c_float)
+_int_p = ctypes.POINTER(ctypes.c_int)
+
+
+def load(path=None):
+    """Load the library, by default libsdf.so next to this file."""
+    if path is None:
+        path = os.path.join(os.path.dirname(os.path.abspath(__file__)), "libsdf.so")
+    lib = ctypes.CDLL(path)
+    lib.create_scene.restype = ctypes.c_void_p
+    lib.destroy_scene.argtypes = [ctypes.c_void_p]
+    lib.begin_scene.argtypes = [ctypes.c_void_p, ctypes.c_size_t, ctypes.c_size_t]
+    lib.scene_add_layer.argtypes = [ctypes.c_void_p, ctypes.c_int]
+    lib.scene_add_points.argtypes = [ctypes.c_void_p, ctypes.c_size_t, _float_p, _float_p, _float_p]
+    lib.scene_add_segments.argtypes = [ctypes.c_void_p, ctypes.c_size_t, _int_p, _float_p]
+    lib.scene_add_polyline.argtypes = [ctypes.c_void_p, ctypes.c_size_t, _int_p, ctypes.c_float]
+    lib.scene_add_polygon.argtypes = [ctypes.c_void_p, ctypes.c_size_t, _int_p, ctypes.c_float]
+    lib.end_scene.argtypes = [ctypes.c_void_p]
+    lib.render_rgb.argtypes = [ctypes.c_void_p, ctypes.c_size_t, ctypes.c_size_t, ctypes.c_size_t, ctypes.c_void_p]
+    return lib
+
+
+class SdfError(Exception):
+    """A call of the library failed, code is one of the return codes of render.h."""
+
+    def __init__(self, call, code):
+        super().__init__(f"{call} failed with error {code}")
+        self.code = code
+
+
+def _pointer(buffer, ctype, width, count=None):
+    """Pointer to the items of buffer, width values per item. Return the pointer and the item count."""
+    if buffer is None:
+        return None, count
+    if numpy is not None and isinstance(buffer, numpy.ndarray):
+        dtype = numpy.float32 if ctype is ctypes.c_float else numpy.int32
+        if buffer.dtype != dtype or not buffer.flags["C_CONTIGUOUS"]:
+            raise TypeError(f"Expected a C contiguous array of {numpy.dtype(dtype).name}, convert it with numpy.ascontiguousarray")
+        size = buffer.size
+        pointer = buffer.ctypes.data_as(ctypes.POINTER(ctype))
+    else:
+        view = memoryview(buffer).cast("B")
+        size = view.nbytes // ctypes.sizeof(ctype)
+        pointer = ctypes.cast((ctypes.c_char * view.nbytes).from_buffer(view), ctypes.POINTER(ctype))
+    if size % width != 0 or (count is not None and size // width != count):
+        raise ValueError(f"Expected {width} values per item, for {count} items, got {size} values")
+    return pointer, size // width
+
+
+class Scene:
+    """A scene for one canvas size, built layer by layer."""
+
+    def __init__(self, width, height, lib=None):
+        self.lib = lib or load()
+        self.width = width
+        self.height = height
+        self.handle = self.lib.create_scene()
+        if not self.handle:
+            raise MemoryError("Failed to allocate the scene")
+        self.lib.begin_scene(self.handle, width, height)
+        self.size = 0  # Geoms in the current layer
+        self.ended = False
+
+    def __del__(self):
+        if getattr(self, "handle", None):
+            self.lib.destroy_scene(self.handle)
+            self.handle = None
+
+    def _check(self, call, res):
+        if res != 0:
+            raise SdfError(call, res)
+
+    def _check_open(self, call):
+        # Rendering ends the scene, which drops and reorders the geoms of the layers, so the indexes no longer match
+        if self.ended:
+            raise RuntimeError(f"{call} after render, start a new layer first")
+
+    def layer(self, fusion=0):
+        """Start a layer, fusion 0 for min, 1 for smooth min."""
+        self._check("scene_add_layer", self.lib.scene_add_layer(self.handle, fusion))
+        self.size = 0
+        self.ended = False
+
+    def points(self, xy, rgba=None, radius=None):
+        """Add the points, return the index of the first one in the layer."""
+        self._check_open("scene_add_points")
+        xy_p, count = _pointer(xy, ctypes.c_float, 2)
+        rgba_p, _ = _pointer(rgba, ctypes.c_float, 4, count)
+        radius_p, _ = _pointer(radius, ctypes.c_float, 1, count)
+        self._check("scene_add_points", self.lib.scene_add_points(self.handle, count, xy_p, rgba_p, radius_p))
+        first = self.size
+        self.size += count
+        return first
+
+    def segments(self, indexes, radius=None):
+        """Add the segments between pairs of points of the layer, return the index of the first one."""
+        self._check_open("scene_add_segments")
+        indexes_p, count = _pointer(indexes, ctypes.c_int, 2)
+        radius_p, _ = _pointer(radius, ctypes.c_float, 1, count)
+        self._check("scene_add_segments", self.lib.scene_add_segments(self.handle, count, indexes_p, radius_p))
+        first = self.size
+        self.size += count
+        return first
+
+    def polyline(self, indexes, radius=0):
+        """Add a polyline through the points of the layer, return its index."""
+        self._check_open("scene_add_polyline")
+        indexes_p, count = _pointer(indexes, ctypes.c_int, 1)
+        self._check("scene_add_polyline", self.lib.scene_add_polyline(self.handle, count, indexes_p, radius))
+        self.size += 1
+        return self.size - 1
+
+    def polygon(self, indexes, radius=0):
+        """Add a filled polygon through the points of the layer, return its index."""
+        self._check_open("scene_add_polygon")
+        indexes_p, count = _pointer(indexes, ctypes.c_int, 1)
+        self._check("scene_add_polygon", self.lib.scene_add_polygon(self.handle, count, indexes_p, radius))
+        self.size += 1
+        return self.size - 1
+
+    def render(self, threads=1, out=None):
+        """Render the scene in out, or a new buffer, of height x width x 3 bytes, from the top row."""
+        if not self.ended:
+            self._check("end_scene", self.lib.end_scene(self.handle))
+            self.ended = True
+        if out is None:
+            if numpy is not None:
+                out = numpy.zeros((self.height, self.width, 3), dtype=numpy.uint8)
+            else:
+                out = bytearray(self.height * self.width * 3)
+        view = memoryview(out).cast("B")
+        if view.nbytes != self.height * self.width * 3:
+            raise ValueError(f"Expected a buffer of {self.height * self.width * 3} bytes, got {view.nbytes}")
+        data = (ctypes.c_char * view.nbytes).from_buffer(view)
+        self._check("render_rgb", self.lib.render_rgb(self.handle, self.width, self.height, threads, data))
+        return out
+
+
+def write_ppm(path, image, width, height):
+    """Write the result of Scene.render as a binary PPM."""
+    with open(path, "wb") as f:
+        f.write(b"P6\n%d %d\n255\n" % (width, height))
+        f.write(memoryview(image).cast("B"))
+
+
+if __name__ == "__main__":
+    # The scene of grid.py, built from arrays
+    import array
+
+    steps = [i / 100 for i in range(10, 100, 10)]
+    xy = array.array("f", [v for x in steps for y in steps for v in (x, y)])
+    rgba = array.array("f", [v for x in steps for y in steps for v in (x, y, 1 - x, 1)])
+    pairs = []
+    for i in range(0, 9*9):
+        if (i % (9+1)) == 0:
+            if i+10 < 9*9:
+                pairs += [i, i+10]
+            continue
+        if ((i+1) % 9) != 0:
+            pairs += [i, i+1]
+        if i+9 < 9*9:
+            pairs += [i, i+9]
+
+    scene = Scene(800, 800)
+    scene.layer(1)
+    scene.points(xy, rgba, array.array("f", [0.015] * 81))
+    scene.segments(array.array("i", pairs), array.array("f", [0.002] * (len(pairs) // 2)))
+    image = scene.render(threads=4)
+    write_ppm(sys.argv[1] if len(sys.argv) > 1 else "canvas.ppm", image, 800, 800)
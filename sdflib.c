@@ -0,0 +1,48 @@
+/*
+    Author: Hugo Roussel, unless indicated otherwise.
+    License: MIT, with parts in CC BY-SA 4.0.
+
+    Shared library for the bindings, like sdf.py with ctypes. Together with the scene builder of render.h,
+    scenes are made from arrays and rendered to memory, without instructions or files in between.
+
+    Build: gcc -shared -fPIC -O3 sdflib.c render.c trace.c -lm -pthread -o libsdf.so
+*/
+
+#include "stdlib.h"
+#include "pthread.h"
+
+#include "render.h"
+
+// Target of the pixel callback, one render at a time
+static pthread_mutex_t _rgb_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned char* _rgb = NULL;
+static size_t _rgb_width = 0;
+static size_t _rgb_height = 0;
+
+static void write_rgb_pixel(int x, int y, float pixel[3]) {
+    if (x >= _rgb_width || y >= _rgb_height) {
+        return;
+    }
+    // The renderer y axis goes up, the rows of the buffer go down
+    unsigned char* data = _rgb + ((_rgb_height - 1 - y) * _rgb_width + x) * 3;
+    data[0] = (unsigned char) (pixel[0] * 255);
+    data[1] = (unsigned char) (pixel[1] * 255);
+    data[2] = (unsigned char) (pixel[2] * 255);
+}
+
+// Render the scene in rgb, height rows of width RGB pixels, from the top row. With threads above 1, see render_tiles.
+extern int render_rgb(Scene* scene, size_t canvas_width, size_t canvas_height, size_t threads, unsigned char* rgb) {
+    int res = OK;
+    pthread_mutex_lock(&_rgb_lock);
+    _rgb = rgb;
+    _rgb_width = canvas_width;
+    _rgb_height = canvas_height;
+    if (threads > 1) {
+        res = render_tiles(scene, canvas_width, canvas_height, threads, &write_rgb_pixel);
+    } else {
+        res = render_canvas(scene, canvas_width, canvas_height, &write_rgb_pixel);
+    }
+    _rgb = NULL;
+    pthread_mutex_unlock(&_rgb_lock);
+    return res;
+}
@@ -0,0 +1,412 @@
+/*
+    Author: Hugo Roussel, unless indicated otherwise.
+    License: MIT, with parts in CC BY-SA 4.0.
+
+    Render daemon, keep the renderer resident and serve render requests over a Unix domain socket.
+
+    Requests are sent one after the other on a connection:
+        RENDER <width> <height> <length>\n
+        <length bytes of instructions>
+    And answered with either:
+        OK <length>\n
+        <length bytes of BMP>
+    or:
+        ERROR <code>\n
+    Sending CANCEL\n, or closing the connection, while the render is running stops it. A CANCEL\n arriving once the
+    render is done is ignored, the answer already sent stands. Shutting down the writing side of the connection
+    after the requests is not a cancel, they are still answered.
+
+    Requests are served by a fixed pool of pre-forked workers, which bound the concurrency.
+    Pending connections wait in the listen queue. Each worker keep a cache of its most recent scenes.
+    When a maximum render time is set, the requests estimated to take longer are rejected before rendering.
+*/
+
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include "errno.h"
+#include "signal.h"
+#include "unistd.h"
+#include "poll.h"
+#include "sys/types.h"
+#include "sys/socket.h"
+#include "sys/un.h"
+#include "sys/wait.h"
+
+#include "render.h"
+#include "image.h"
+
+#define LOG_E(FORMAT, ...) fprintf(stderr, "%s:%d ERROR: " FORMAT "\n", __FILE__, __LINE__, __VA_ARGS__);
+
+#define E_SOCKET -60
+#define E_PROTOCOL -61
+#define E_REJECTED -62
+
+#define DEFAULT_WORKERS 4
+#define DEFAULT_CACHE_SIZE 8
+#define QUEUE_SIZE 64
+#define MAX_CANVAS_SIDE 16384
+#define MAX_INSTRUCTIONS_SIZE (64*1024*1024)
+#define MAX_HEADER_SIZE 128
+
+void print(char* msg) {
+    fprintf(stderr, "%s", msg);
+}
+
+/* Scene cache, one per worker */
+
+typedef struct CachedScene {
+    char* text;
+    size_t len;
+    size_t width;
+    size_t height;
+    Scene* scene; // NULL until the slot is used
+    unsigned long last_used;
+} CachedScene;
+
+CachedScene* cache = NULL;
+size_t cache_size = 0;
+unsigned long cache_clock = 0;
+double max_seconds = 0; // 0 for no limit
+
+FILE* inputFile = NULL;
+int read_instruction_line(char** line, size_t* len) {
+    return getline(line, len, inputFile);
+}
+
+// Return the scene for these instructions and canvas, parsing them only on a cache miss
+Scene* get_scene(char* text, size_t len, size_t width, size_t height) {
+    CachedScene* slot = &(cache[0]);
+    cache_clock++;
+    for (size_t i = 0; i < cache_size; i++) {
+        CachedScene* c = &(cache[i]);
+        if (c->scene && c->len == len && c->width == width && c->height == height && memcmp(c->text, text, len) == 0) {
+            c->last_used = cache_clock;
+            return c->scene;
+        }
+        if (c->last_used < slot->last_used) {
+            slot = c; // Least recently used, unused slots come first
+        }
+    }
+
+    char* copy = realloc(slot->text, len);
+    if (copy == NULL) {
+        return NULL;
+    }
+    slot->text = copy;
+    memcpy(slot->text, text, len);
+    slot->len = len;
+    slot->width = width;
+    slot->height = height;
+    slot->last_used = cache_clock;
+    if (slot->scene == NULL) {
+        slot->scene = create_scene();
+        if (slot->scene == NULL) {
+            return NULL;
+        }
+    }
+
+    inputFile = fmemopen(slot->text, len, "r");
+    if (inputFile == NULL) {
+        slot->len = 0; // Invalidate, the text is kept allocated for reuse
+        slot->last_used = 0;
+        return NULL;
+    }
+    if (read_scene(slot->scene, width, height, &read_instruction_line) != OK) {
+        slot->len = 0;
+        slot->last_used = 0;
+        fclose(inputFile);
+        return NULL;
+    }
+    fclose(inputFile);
+    return slot->scene;
+}
+/* === */
+
+/* Connection handling, in the worker */
+
+int client_fd = -1;
+unsigned char* image = NULL;
+size_t image_capacity = 0;
+int image_stride = 0;
+size_t image_width = 0;
+size_t image_height = 0;
+
+// Poll the client without blocking, a CANCEL message or a hang up stop the render.
+// The end of its input only means no more requests follow, as with shutdown(SHUT_WR).
+void check_cancel() {
+    struct pollfd pfd = {client_fd, POLLIN, 0};
+    if (poll(&pfd, 1, 0) <= 0) {
+        return;
+    }
+    if (pfd.revents & (POLLHUP | POLLERR)) {
+        cancel_render();
+        return;
+    }
+    char peek[7];
+    ssize_t n = recv(client_fd, peek, 7, MSG_PEEK | MSG_DONTWAIT);
+    if (n == 7 && strncmp(peek, "CANCEL\n", 7) == 0) {
+        recv(client_fd, peek, 7, 0);
+        cancel_render();
+    }
+}
+
+void write_image_pixel(int x, int y, float pixel[3]) {
+    if (x == 0) {
+        check_cancel();
+    }
+    if (x >= image_width || y >= image_height) {
+        return;
+    }
+    encode_bitmap_pixel(image + BITMAP_HEADER_SIZE + ((size_t) y)*image_stride + x*BYTES_PER_PIXEL, pixel);
+}
+
+int write_all(int fd, const void* data, size_t len) {
+    const char* p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return E_SOCKET;
+        }
+        p += n;
+        len -= n;
+    }
+    return OK;
+}
+
+int read_all(int fd, void* data, size_t len) {
+    char* p = data;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return E_SOCKET;
+        }
+        p += n;
+        len -= n;
+    }
+    return OK;
+}
+
+// Read a \n terminated line. Return the line length, 0 on a clean end of connection, or an error
+int read_header(int fd, char* header) {
+    size_t i = 0;
+    for (i = 0; i < MAX_HEADER_SIZE - 1; i++) {
+        ssize_t n = read(fd, &(header[i]), 1);
+        if (n < 0 && errno == EINTR) {
+            i--;
+            continue;
+        }
+        if (n <= 0) {
+            return (i == 0 && n == 0) ? 0 : E_SOCKET;
+        }
+        if (header[i] == '\n') {
+            break;
+        }
+    }
+    header[i] = '\0';
+    return (i < MAX_HEADER_SIZE - 1) ? (int) i + 1 : E_PROTOCOL;
+}
+
+int send_error(int fd, int code) {
+    char msg[32];
+    int len = snprintf(msg, 32, "ERROR %d\n", code);
+    return write_all(fd, msg, len);
+}
+
+// Serve one request. Return OK when the connection can be reused for another request
+int serve_request(int fd, char** text, size_t* text_capacity) {
+    char header[MAX_HEADER_SIZE];
+    int res = 0;
+    do {
+        // A CANCEL sent as the previous render ended has nothing left to stop
+        res = read_header(fd, header);
+    } while (res > 0 && strcmp(header, "CANCEL") == 0);
+    if (res <= 0) {
+        return (res == 0) ? E_SOCKET : res;
+    }
+
+    size_t width, height, len;
+    if (sscanf(header, "RENDER %zu %zu %zu", &width, &height, &len) != 3) {
+        LOG_E("Bad request header: %s", header);
+        send_error(fd, E_PROTOCOL);
+        return E_PROTOCOL;
+    }
+    if (width == 0 || height == 0 || width > MAX_CANVAS_SIDE || height > MAX_CANVAS_SIDE || len == 0 || len > MAX_INSTRUCTIONS_SIZE) {
+        LOG_E("Request out of bounds: %s", header);
+        send_error(fd, E_BOUND_REACHED);
+        return E_BOUND_REACHED;
+    }
+
+    if (len > *text_capacity) {
+        char* grown = realloc(*text, len);
+        if (grown == NULL) {
+            send_error(fd, E_ALLOC);
+            return E_ALLOC;
+        }
+        *text = grown;
+        *text_capacity = len;
+    }
+    if (read_all(fd, *text, len) != OK) {
+        return E_SOCKET;
+    }
+
+    Scene* scene = get_scene(*text, len, width, height);
+    if (scene == NULL) {
+        return send_error(fd, E_ALLOC);
+    }
+    if (max_seconds > 0) {
+        RenderCost cost;
+        estimate_render_cost(scene, width, height, &cost);
+        if (cost.seconds > max_seconds) {
+            LOG_E("Rejected a render estimated at %.3fs", cost.seconds);
+            return send_error(fd, E_REJECTED);
+        }
+    }
+
+    size_t size = bitmap_size(width, height);
+    if (size > image_capacity) {
+        unsigned char* grown = realloc(image, size);
+        if (grown == NULL) {
+            return send_error(fd, E_ALLOC);
+        }
+        image = grown;
+        image_capacity = size;
+    }
+    memset(image, 0, size); // Row padding must be zeroed
+    write_bitmap_headers(image, width, height);
+    image_width = width;
+    image_height = height;
+    image_stride = bitmap_stride(width);
+
+    client_fd = fd;
+    res = render_canvas(scene, width, height, &write_image_pixel);
+    client_fd = -1;
+    if (res != OK) {
+        return send_error(fd, res);
+    }
+
+    int hlen = snprintf(header, MAX_HEADER_SIZE, "OK %zu\n", size);
+    if (write_all(fd, header, hlen) != OK) {
+        return E_SOCKET;
+    }
+    return write_all(fd, image, size);
+}
+
+void run_worker(int listen_fd, size_t cache_slots) {
+    cache_size = cache_slots;
+    cache = calloc(cache_size, sizeof(CachedScene));
+    // Preallocate the scenes, so the first requests do not pay for it
+    for (size_t i = 0; i < cache_size; i++) {
+        cache[i].scene = create_scene();
+    }
+    set_message_callback(&print);
+
+    char* text = NULL;
+    size_t text_capacity = 0;
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR) {
+                LOG_E("accept failed: %s", strerror(errno));
+            }
+            continue;
+        }
+        while (serve_request(fd, &text, &text_capacity) == OK) {}
+        close(fd);
+    }
+}
+/* === */
+
+/* Pool management, in the parent */
+
+volatile sig_atomic_t stopping = 0;
+
+void handle_stop(int sig) {
+    stopping = 1;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || argc > 5) {
+        fprintf(stderr, "Usage: %s <socketPath> [workers] [cacheSize] [maxSeconds]\n", argv[0]);
+        return -1;
+    }
+    char* socket_path = argv[1];
+    int workers = (argc > 2) ? atoi(argv[2]) : DEFAULT_WORKERS;
+    int cache_slots = (argc > 3) ? atoi(argv[3]) : DEFAULT_CACHE_SIZE;
+    max_seconds = (argc > 4) ? atof(argv[4]) : 0;
+    if (workers <= 0 || cache_slots <= 0) {
+        fprintf(stderr, "workers and cacheSize must be positive\n");
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        LOG_E("Socket path too long: %s", socket_path);
+        return E_SOCKET;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(listen_fd, QUEUE_SIZE) < 0) {
+        LOG_E("Failed to listen on %s: %s", socket_path, strerror(errno));
+        return E_SOCKET;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &handle_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    pid_t* pids = calloc(workers, sizeof(pid_t));
+    while (!stopping) {
+        // (Re)spawn the missing workers
+        for (int i = 0; i < workers; i++) {
+            if (pids[i] > 0) {
+                continue;
+            }
+            pids[i] = fork();
+            if (pids[i] == 0) {
+                signal(SIGINT, SIG_DFL);
+                signal(SIGTERM, SIG_DFL);
+                run_worker(listen_fd, cache_slots);
+                exit(OK);
+            }
+            if (pids[i] < 0) {
+                LOG_E("fork failed: %s", strerror(errno));
+            }
+        }
+
+        pid_t pid = wait(NULL);
+        for (int i = 0; i < workers; i++) {
+            if (pids[i] == pid) {
+                pids[i] = 0;
+            }
+        }
+        if (pid < 0 && errno == ECHILD) {
+            sleep(1); // Every fork failed, avoid spinning
+        }
+    }
+
+    for (int i = 0; i < workers; i++) {
+        if (pids[i] > 0) {
+            kill(pids[i], SIGTERM);
+        }
+    }
+    while (wait(NULL) > 0) {}
+    close(listen_fd);
+    unlink(socket_path);
+    free(pids);
+
+    exit(OK);
+}
@@ -0,0 +1,150 @@
+/*
+    Author: Hugo Roussel, unless indicated otherwise.
+    License: MIT, with parts in CC BY-SA 4.0.
+
+    Raw video frames, written one after the other to stdout or a FIFO, for an encoder to read directly.
+
+    The frame is kept encoded, in the layout of the stream, so the pixels not rendered again for a frame keep their
+    bytes and the whole frame goes out in a single write, with no copy.
+*/
+
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include "errno.h"
+#include "fcntl.h"
+#include "signal.h"
+#include "unistd.h"
+
+#include "render.h"
+#include "stream.h"
+
+#define LOG_E(FORMAT, ...) fprintf(stderr, "%s:%d ERROR: " FORMAT "\n", __FILE__, __LINE__, __VA_ARGS__);
+
+#define PAGE_SIZE 4096
+
+static const char* STREAM_NAMES[STREAM_FORMATS] = {"rgb", "rgba", "y4m"};
+static const char* Y4M_FRAME = "FRAME\n";
+
+int find_stream_format(const char* name) {
+    for (int i = 0; i < STREAM_FORMATS; i++) {
+        if (strcmp(name, STREAM_NAMES[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int write_all(int fd, const unsigned char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_E("Failed to write the frame stream: %s", strerror(errno));
+            return E_STREAM_WRITE;
+        }
+        data += written;
+        size -= written;
+    }
+    return OK;
+}
+
+static size_t bytes_per_pixel(int format) {
+    return (format == STREAM_RGBA) ? 4 : 3;
+}
+
+int open_frame_stream(FrameStream* stream, const char* path, int format, size_t width, size_t height, int fps) {
+    if (format < 0 || format >= STREAM_FORMATS || width == 0 || height == 0 || fps <= 0) {
+        LOG_E("Bad frame stream %d, %zux%zu at %d fps", format, width, height, fps);
+        return E_STREAM_WRITE;
+    }
+    stream->format = format;
+    stream->width = width;
+    stream->height = height;
+    size_t prefix = (format == STREAM_Y4M) ? strlen(Y4M_FRAME) : 0;
+    stream->size = prefix + width*height*bytes_per_pixel(format);
+    void* buffer = NULL;
+    if (posix_memalign(&buffer, PAGE_SIZE, stream->size) != 0) {
+        return E_ALLOC;
+    }
+    stream->buffer = buffer;
+    stream->pixels = stream->buffer + prefix;
+    memcpy(stream->buffer, Y4M_FRAME, prefix);
+    // Black, and opaque
+    if (format == STREAM_Y4M) {
+        size_t plane = width*height;
+        memset(stream->pixels, 16, plane);
+        memset(stream->pixels + plane, 128, 2*plane);
+    } else {
+        memset(stream->pixels, 0, stream->size);
+        if (format == STREAM_RGBA) {
+            for (size_t i = 3; i < stream->size; i += 4) {
+                stream->pixels[i] = 255;
+            }
+        }
+    }
+
+    if (strcmp(path, "-") == 0) {
+        stream->fd = STDOUT_FILENO;
+    } else {
+        // Opening a FIFO waits for its reader
+        stream->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (stream->fd < 0) {
+            LOG_E("Failed to open output stream %s", path);
+            free(stream->buffer);
+            stream->buffer = NULL;
+            return E_FILE_OPEN;
+        }
+    }
+    // An encoder closing the pipe early is reported as a failed write, instead of killing the process
+    signal(SIGPIPE, SIG_IGN);
+
+    if (format == STREAM_Y4M) {
+        char header[128];
+        int len = snprintf(header, sizeof(header), "YUV4MPEG2 W%zu H%zu F%d:1 Ip A1:1 C444\n", width, height, fps);
+        if (write_all(stream->fd, (unsigned char*) header, len) != OK) {
+            close_frame_stream(stream);
+            return E_STREAM_WRITE;
+        }
+    }
+    return OK;
+}
+
+static inline unsigned char to_byte(float value) {
+    return (unsigned char) (value + 0.5f);
+}
+
+void encode_stream_pixel(FrameStream* stream, int x, int y, float pixel[3]) {
+    // The stream starts with the top row
+    size_t i = (stream->height - 1 - y)*stream->width + x;
+    if (stream->format == STREAM_Y4M) {
+        // BT.601, Y in [16, 235], Cb and Cr in [16, 240]
+        float r = pixel[0], g = pixel[1], b = pixel[2];
+        size_t plane = stream->width*stream->height;
+        stream->pixels[i] = to_byte(16 + 219*(0.299f*r + 0.587f*g + 0.114f*b));
+        stream->pixels[plane + i] = to_byte(128 + 224*(-0.168736f*r - 0.331264f*g + 0.5f*b));
+        stream->pixels[2*plane + i] = to_byte(128 + 224*(0.5f*r - 0.418688f*g - 0.081312f*b));
+    } else {
+        // Rounded as encode_bitmap_pixel, so the bytes match the BMP
+        unsigned char* data = stream->pixels + i*bytes_per_pixel(stream->format);
+        data[0] = (unsigned char) (pixel[0] * 255);
+        data[1] = (unsigned char) (pixel[1] * 255);
+        data[2] = (unsigned char) (pixel[2] * 255);
+    }
+}
+
+int write_stream_frame(FrameStream* stream) {
+    return write_all(stream->fd, stream->buffer, stream->size);
+}
+
+void close_frame_stream(FrameStream* stream) {
+    if (stream->fd >= 0 && stream->fd != STDOUT_FILENO) {
+        close(stream->fd);
+    }
+    stream->fd = -1;
+    free(stream->buffer);
+    stream->buffer = NULL;
+    stream->pixels = NULL;
+}
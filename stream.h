@@ -0,0 +1,40 @@
+/*
+    Author: Hugo Roussel, unless indicated otherwise.
+    License: MIT, with parts in CC BY-SA 4.0.
+
+    Raw video frames, written one after the other to stdout or a FIFO, for an encoder to read directly.
+*/
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "sys/types.h"
+
+#define E_STREAM_WRITE -110
+
+// Stream formats
+#define STREAM_RGB 0 // RGB24, from the top row, nothing between the frames
+#define STREAM_RGBA 1 // Same, with an opaque alpha
+#define STREAM_Y4M 2 // YUV4MPEG2, planar 4:4:4, BT.601 limited range. A header, then a FRAME line before each frame.
+#define STREAM_FORMATS 3
+
+typedef struct FrameStream {
+    int fd;
+    int format;
+    size_t width;
+    size_t height;
+    unsigned char* buffer; // The next write: the frame line of y4m, then the pixels
+    unsigned char* pixels; // In buffer
+    size_t size; // Of the write
+} FrameStream;
+
+// Return one of the "Stream formats" from its name (rgb, rgba or y4m), or -1
+extern int find_stream_format(const char* name);
+// Open path, or stdout for "-". The y4m header is written at once, with fps frames per second.
+extern int open_frame_stream(FrameStream* stream, const char* path, int format, size_t width, size_t height, int fps);
+// Set a pixel of the next frame, y going up as in the renders. The pixels keep their value from a frame to the next.
+extern void encode_stream_pixel(FrameStream* stream, int x, int y, float pixel[3]);
+// Write the frame, in a single write of a page aligned buffer
+extern int write_stream_frame(FrameStream* stream);
+extern void close_frame_stream(FrameStream* stream);
+
+#endif
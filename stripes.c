@@ -0,0 +1,119 @@
+/*
+    Author: Hugo Roussel, unless indicated otherwise.
+    License: MIT, with parts in CC BY-SA 4.0.
+
+    Render a scene in horizontal stripes spread over workers, merged into one BMP file.
+
+    The output file is memory mapped and shared, each worker write its rows in place,
+    so merging the stripes cost nothing. Before rendering, a worker cull the geometries
+    which cannot change its stripe.
+*/
+
+#include "stdlib.h"
+#include "stdio.h"
+#include "fcntl.h"
+#include "unistd.h"
+#include "sys/mman.h"
+#include "sys/wait.h"
+
+#include "stripes.h"
+#include "image.h"
+#include "trace.h"
+
+#define LOG_E(FORMAT, ...) fprintf(stderr, "%s:%d ERROR: " FORMAT "\n", __FILE__, __LINE__, __VA_ARGS__);
+
+#define STRIPES_PER_WORKER 4 // Smaller stripes balance the load better, the cost of a scene is rarely uniform
+
+/* Local transport */
+
+unsigned char* stripe_rows = NULL;
+int stripe_stride = 0;
+size_t stripe_y0 = 0;
+
+void write_stripe_pixel(int x, int y, float pixel[3]) {
+    encode_bitmap_pixel(stripe_rows + (y - stripe_y0)*stripe_stride + x*BYTES_PER_PIXEL, pixel);
+}
+
+long local_start(StripeTransport* transport, Scene* scene, size_t width, size_t y0, size_t y1, unsigned char* rows, int stride) {
+    (void) transport; // No state, the workers are forked
+    pid_t pid = fork();
+    if (pid != 0) {
+        return (pid < 0) ? E_STRIPE_WORKER : pid;
+    }
+
+    // Worker, the scene is a private copy
+    trace_child();
+    set_phase_callback(NULL); // The parent measures the phases, this process included
+    stripe_rows = rows;
+    stripe_stride = stride;
+    stripe_y0 = y0;
+    cull_scene(scene, 0, y0, width, y1);
+    int res = render_region(scene, 0, y0, width, y1, &write_stripe_pixel);
+    trace_flush();
+    _exit(res == OK ? 0 : 1);
+}
+
+int local_wait(StripeTransport* transport, long handle) {
+    (void) transport;
+    int status = 0;
+    if (waitpid((pid_t) handle, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return E_STRIPE_WORKER;
+    }
+    return OK;
+}
+
+StripeTransport local_transport = {&local_start, &local_wait, NULL};
+/* === */
+
+int render_stripes(Scene* scene, size_t width, size_t height, size_t workers, char* output, StripeTransport* transport) {
+    int res = OK;
+
+    int fd = open(output, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOG_E("Failed to open output file %s", output);
+        return E_FILE_OPEN;
+    }
+    size_t size = bitmap_size(width, height);
+    if (ftruncate(fd, size) != 0) {
+        LOG_E("Failed to resize output file %s to %ld bytes", output, size);
+        close(fd);
+        return E_FILE_OPEN;
+    }
+    unsigned char* image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        LOG_E("Failed to map output file %s", output);
+        return E_FILE_OPEN;
+    }
+    write_bitmap_headers(image, width, height);
+
+    int stride = bitmap_stride(width);
+    size_t stripes = workers * STRIPES_PER_WORKER;
+    if (stripes > height) {
+        stripes = height;
+    }
+    long* handles = malloc(sizeof(long) * stripes);
+    size_t started = 0;
+    size_t done = 0;
+    while (done < stripes) {
+        // Keep up to workers stripes in flight, and wait for them in order
+        while (started < stripes && started - done < workers) {
+            size_t y0 = (height * started) / stripes;
+            size_t y1 = (height * (started + 1)) / stripes;
+            handles[started] = transport->start(transport, scene, width, y0, y1, image + BITMAP_HEADER_SIZE + y0*stride, stride);
+            started++;
+        }
+        double wait_start = trace_now();
+        int stripe_res = (handles[done] < 0) ? (int) handles[done] : transport->wait(transport, handles[done]);
+        trace_span("wait stripe", done, wait_start);
+        if (stripe_res != OK) {
+            LOG_E("Stripe %ld failed with error %d", done, stripe_res);
+            res = stripe_res;
+        }
+        done++;
+    }
+    free(handles);
+
+    munmap(image, size);
+    return res;
+}
@@ -0,0 +1,34 @@
+/*
+    Author: Hugo Roussel, unless indicated otherwise.
+    License: MIT, with parts in CC BY-SA 4.0.
+
+    Render a scene in horizontal stripes spread over workers, merged into one BMP file.
+*/
+#ifndef STRIPES_H
+#define STRIPES_H
+
+#include "sys/types.h"
+
+#include "render.h"
+
+#define E_STRIPE_WORKER -70
+
+typedef struct StripeTransport StripeTransport;
+
+// How the stripes reach the workers. A transport could as well send them to another machine.
+struct StripeTransport {
+    // Start rendering the rows [y0, y1[ of the scene. The pixels go in rows, laid out like a BMP pixel array.
+    // Return a handle for wait, or a negative error.
+    long (*start)(StripeTransport* transport, Scene* scene, size_t width, size_t y0, size_t y1, unsigned char* rows, int stride);
+    // Wait for a started stripe to be rendered, return its error code
+    int (*wait)(StripeTransport* transport, long handle);
+    void* ctx;
+};
+
+// Fork a local process per stripe, writing straight into the shared output
+extern StripeTransport local_transport;
+
+// Render the scene in the BMP file output, with up to workers stripes in flight at the same time
+extern int render_stripes(Scene* scene, size_t width, size_t height, size_t workers, char* output, StripeTransport* transport);
+
+#endif
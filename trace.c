@@ -0,0 +1,132 @@
+/*
+    Author: Hugo Roussel, unless indicated otherwise.
+    License: MIT, with parts in CC BY-SA 4.0.
+
+    Timeline of the render phases, written as Chrome trace events (JSON).
+
+    The spans are kept in memory, and written at the end, so tracing does not add IO to the render.
+    Forked workers share the file, opened in append mode: each of them write its own spans
+    in one go before exiting, the main process write its spans last, and close the JSON array.
+*/
+
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include "fcntl.h"
+#include "unistd.h"
+#include "time.h"
+#include "pthread.h"
+
+#include "render.h"
+#include "trace.h"
+
+#define LOG_E(FORMAT, ...) fprintf(stderr, "%s:%d ERROR: " FORMAT "\n", __FILE__, __LINE__, __VA_ARGS__);
+
+#define MAX_EVENT_SIZE 256
+
+static int _trace_fd = -1;
+static int _pid = 0;
+static double _origin = 0; // Timestamps are relative to trace_open, in the forked workers too
+static char* _events = NULL;
+static size_t _events_size = 0;
+static size_t _events_capacity = 0;
+static pthread_mutex_t _events_lock = PTHREAD_MUTEX_INITIALIZER;
+static int _next_tid = 1;
+static __thread int _tid = 0;
+
+static double clock_us() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+static void write_all(const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(_trace_fd, data, size);
+        if (written <= 0) {
+            LOG_E("Failed to write %ld bytes of trace", size);
+            return;
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+extern int trace_open(const char* path) {
+    _trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (_trace_fd < 0) {
+        LOG_E("Failed to open trace file %s", path);
+        return E_TRACE_OPEN;
+    }
+    _origin = clock_us();
+    _pid = getpid();
+    write_all("[\n", 2);
+    return OK;
+}
+
+extern void trace_flush() {
+    if (_trace_fd < 0) {
+        return;
+    }
+    pthread_mutex_lock(&_events_lock);
+    write_all(_events, _events_size);
+    _events_size = 0;
+    pthread_mutex_unlock(&_events_lock);
+}
+
+extern void trace_close() {
+    if (_trace_fd < 0) {
+        return;
+    }
+    trace_flush();
+    // Each event ends with a comma, this last one close the array
+    char end[MAX_EVENT_SIZE];
+    int size = snprintf(end, MAX_EVENT_SIZE, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"main\"}}\n]\n", _pid);
+    write_all(end, size);
+    close(_trace_fd);
+    _trace_fd = -1;
+    free(_events);
+    _events = NULL;
+    _events_capacity = 0;
+}
+
+extern void trace_child() {
+    _events_size = 0;
+    _pid = getpid();
+}
+
+extern double trace_now() {
+    return (_trace_fd < 0) ? 0 : clock_us() - _origin;
+}
+
+extern void trace_span(const char* name, long index, double start) {
+    if (_trace_fd < 0) {
+        return;
+    }
+    double end = trace_now();
+    if (_tid == 0) {
+        _tid = __atomic_fetch_add(&_next_tid, 1, __ATOMIC_RELAXED);
+    }
+
+    char event[MAX_EVENT_SIZE];
+    int size = snprintf(event, MAX_EVENT_SIZE, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d", name, start, end - start, _pid, _tid);
+    if (index >= 0) {
+        size += snprintf(event + size, MAX_EVENT_SIZE - size, ",\"args\":{\"index\":%ld}", index);
+    }
+    size += snprintf(event + size, MAX_EVENT_SIZE - size, "},\n");
+
+    pthread_mutex_lock(&_events_lock);
+    if (_events_size + size > _events_capacity) {
+        size_t capacity = (_events_capacity == 0) ? 1 << 16 : _events_capacity * 2;
+        char* events = realloc(_events, capacity);
+        if (events == NULL) {
+            pthread_mutex_unlock(&_events_lock);
+            return; // The span is lost, the render goes on
+        }
+        _events = events;
+        _events_capacity = capacity;
+    }
+    memcpy(_events + _events_size, event, size);
+    _events_size += size;
+    pthread_mutex_unlock(&_events_lock);
+}
@@ -0,0 +1,25 @@
+/*
+    Author: Hugo Roussel, unless indicated otherwise.
+    License: MIT, with parts in CC BY-SA 4.0.
+
+    Timeline of the render phases, written as Chrome trace events (JSON), to open in Perfetto or chrome://tracing.
+*/
+#ifndef TRACE_H
+#define TRACE_H
+
+#define E_TRACE_OPEN -80
+
+// Start recording spans, they are written to path by trace_close. Until then, tracing cost one test per span.
+extern int trace_open(const char* path);
+// Write the spans recorded by this process, and end the file
+extern void trace_close();
+// In a forked process, forget the spans of the parent, and write the new ones with trace_flush before exiting
+extern void trace_child();
+extern void trace_flush();
+
+// Current time for trace_span, 0 when not tracing
+extern double trace_now();
+// Record the span named name, from start to now, on the calling thread. index is shown in the span args, unless negative.
+extern void trace_span(const char* name, long index, double start);
+
+#endif
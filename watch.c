@@ -0,0 +1,343 @@
+/*
+    Author: Hugo Roussel, unless indicated otherwise.
+    License: MIT, with parts in CC BY-SA 4.0.
+
+    Render a scene again each time its file is saved, parsing and rendering again only the layers that changed.
+
+    The file is read whole, and split in sections: the lines before the first LAYER or GROUP, then one section
+    per LAYER or GROUP line. The sections are compared with the ones of the previous read, the inotify events
+    on the directory of the file tell when to read it again, which also catches the editors saving by renaming.
+*/
+
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include "libgen.h"
+#include "poll.h"
+#include "time.h"
+#include "unistd.h"
+#include "sys/inotify.h"
+
+#include "watch.h"
+#include "image.h"
+#include "trace.h"
+
+#define LOG_E(FORMAT, ...) fprintf(stderr, "%s:%d ERROR: " FORMAT "\n", __FILE__, __LINE__, __VA_ARGS__);
+
+#define MAX_SECTIONS 64 // Above, the scene is always read again whole
+#define DEBOUNCE_MS 20 // Events closer than this are handled at once, an editor saving can write several times
+
+typedef struct Section {
+    char kind; // 'L' for a layer, 'G' for a group, 'H' for the lines before them
+    size_t first_line; // Starting at 1
+    const char* text;
+    size_t size;
+} Section;
+
+// One read of the file
+typedef struct Source {
+    char* text;
+    size_t size;
+    Section sections[MAX_SECTIONS];
+    size_t count; // Can be above MAX_SECTIONS, only the first ones are kept
+} Source;
+
+static unsigned char* _image = NULL; // The BMP file
+static int _stride = 0;
+static size_t _width = 0;
+static size_t _height = 0;
+static const char* _next = NULL; // Next line given to the parser
+static const char* _end = NULL;
+
+static double now_ms() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1e3 + t.tv_nsec*1e-6;
+}
+
+// Give the lines of [_next, _end[, as getline would
+static int read_text_line(char** line, size_t* len) {
+    if (_next >= _end) {
+        return -1;
+    }
+    const char* eol = memchr(_next, '\n', _end - _next);
+    size_t size = (eol ? eol + 1 : _end) - _next;
+    if (size + 1 > *len) {
+        *len = size + 1;
+        *line = realloc(*line, *len);
+    }
+    memcpy(*line, _next, size);
+    (*line)[size] = '\0';
+    _next += size;
+    return size;
+}
+
+static void write_pixel(int x, int y, float pixel[3]) {
+    if (x >= _width || y >= _height) {
+        return;
+    }
+    encode_bitmap_pixel(_image + BITMAP_HEADER_SIZE + ((size_t) y)*_stride + x*BYTES_PER_PIXEL, pixel);
+}
+
+/* Sections */
+
+static void add_section(Source* source, char kind, size_t line, const char* text) {
+    if (source->count < MAX_SECTIONS) {
+        source->sections[source->count] = (Section){kind, line, text, 0};
+    }
+    source->count++;
+}
+
+static int read_source(const char* path, Source* source) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        LOG_E("Failed to open input file %s", path);
+        return E_FILE_OPEN;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    source->text = malloc(size > 0 ? size : 1);
+    if (source->text == NULL) {
+        fclose(file);
+        return E_ALLOC;
+    }
+    source->size = fread(source->text, 1, size, file);
+    fclose(file);
+
+    source->count = 0;
+    add_section(source, 'H', 1, source->text);
+    const char* end = source->text + source->size;
+    size_t line = 1;
+    for (const char* p = source->text; p < end; line++) {
+        if (end - p >= 6 && (strncmp(p, "LAYER(", 6) == 0 || strncmp(p, "GROUP(", 6) == 0)) {
+            add_section(source, p[0], line, p);
+        }
+        const char* eol = memchr(p, '\n', end - p);
+        p = eol ? eol + 1 : end;
+    }
+    size_t kept = (source->count < MAX_SECTIONS) ? source->count : MAX_SECTIONS;
+    for (size_t i = 0; i < kept; i++) {
+        const char* next = (i + 1 < kept) ? source->sections[i + 1].text : end;
+        source->sections[i].size = next - source->sections[i].text;
+    }
+    return OK;
+}
+
+static int same_section(Section* a, Section* b) {
+    return a->size == b->size && memcmp(a->text, b->text, a->size) == 0;
+}
+
+// The layers can be parsed one by one when only layer sections changed, and none was added or removed
+static int same_structure(Source* a, Source* b) {
+    if (a->count != b->count || a->count > MAX_SECTIONS) {
+        return 0;
+    }
+    for (size_t i = 0; i < a->count; i++) {
+        if (a->sections[i].kind != b->sections[i].kind || (a->sections[i].kind != 'L' && !same_section(&(a->sections[i]), &(b->sections[i])))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+/* === */
+
+static int write_output(const char* output) {
+    char path[MAX_PATH];
+    snprintf(path, MAX_PATH, "%s.tmp", output);
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        LOG_E("Failed to open output file %s", path);
+        return E_FILE_OPEN;
+    }
+    size_t size = bitmap_size(_width, _height);
+    int written = fwrite(_image, 1, size, file) == size;
+    written = (fclose(file) == 0) && written;
+    if (!written || rename(path, output) != 0) {
+        LOG_E("Failed to write output file %s", output);
+        remove(path);
+        return E_FILE_OPEN;
+    }
+    return OK;
+}
+
+static int render_whole(Scene* scene, Source* source, size_t threads) {
+    int res = OK;
+    _next = source->text;
+    _end = source->text + source->size;
+    double parse_start = trace_now();
+    res = read_scene(scene, _width, _height, &read_text_line);
+    trace_span("parse", -1, parse_start);
+    if (res == OK) {
+        double render_start = trace_now();
+        res = render_tiles(scene, _width, _height, threads, &write_pixel);
+        trace_span("render", -1, render_start);
+    }
+    return res;
+}
+
+// Parse again the layers that changed, and render the regions they change. Return the count of layers parsed again,
+// or a negative error.
+static int render_changes(Scene* scene, Source* previous, Source* source) {
+    size_t rects[MAX_SECTIONS][4];
+    size_t size = 0;
+    size_t layer = 0;
+    int changed = 0;
+    for (size_t i = 0; i < source->count; i++) {
+        Section* section = &(source->sections[i]);
+        if (section->kind != 'L') {
+            continue;
+        }
+        if (!same_section(section, &(previous->sections[i]))) {
+            size_t r[4] = {0, 0, 0, 0};
+            _next = section->text;
+            _end = section->text + section->size;
+            double parse_start = trace_now();
+            int res = reread_layer(scene, layer, section->first_line, &read_text_line, r);
+            trace_span("parse layer", layer, parse_start);
+            if (res != OK) {
+                return res;
+            }
+            changed++;
+            if (r[0] < r[2] && r[1] < r[3]) {
+                memcpy(rects[size++], r, sizeof(r));
+            }
+        }
+        layer++;
+    }
+
+    // Merge the overlapping regions, so that no pixel is rendered twice
+    for (size_t i = 0; i < size; i++) {
+        for (size_t j = i + 1; j < size; j++) {
+            size_t* a = rects[i];
+            size_t* b = rects[j];
+            if (a[0] < b[2] && b[0] < a[2] && a[1] < b[3] && b[1] < a[3]) {
+                a[0] = (b[0] < a[0]) ? b[0] : a[0];
+                a[1] = (b[1] < a[1]) ? b[1] : a[1];
+                a[2] = (b[2] > a[2]) ? b[2] : a[2];
+                a[3] = (b[3] > a[3]) ? b[3] : a[3];
+                memcpy(b, rects[--size], sizeof(rects[0]));
+                i = (size_t) -1; // a grew, check all the regions again
+                break;
+            }
+        }
+    }
+    double render_start = trace_now();
+    for (size_t i = 0; i < size; i++) {
+        int res = render_region(scene, rects[i][0], rects[i][1], rects[i][2], rects[i][3], &write_pixel);
+        if (res != OK) {
+            return res;
+        }
+    }
+    trace_span("render", -1, render_start);
+    return changed;
+}
+
+// Block until the file name in the watched directory is written or replaced, then let the burst of events pass
+static int wait_change(int fd, const char* name) {
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int matched = 0;
+    int timeout = -1;
+    struct pollfd pfd = {fd, POLLIN, 0};
+    while (1) {
+        int ready = poll(&pfd, 1, timeout);
+        if (ready < 0) {
+            LOG_E("Failed to wait for changes to %s", name);
+            return E_WATCH;
+        }
+        if (ready == 0) {
+            return OK; // Quiet since the change
+        }
+        ssize_t len = read(fd, events, sizeof(events));
+        if (len <= 0) {
+            LOG_E("Failed to read the changes to %s", name);
+            return E_WATCH;
+        }
+        for (char* p = events; p < events + len;) {
+            struct inotify_event* event = (struct inotify_event*) p;
+            if (event->len > 0 && strcmp(event->name, name) == 0) {
+                matched = 1;
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+        if (matched) {
+            timeout = DEBOUNCE_MS;
+        }
+    }
+}
+
+int render_watch(const char* input, size_t width, size_t height, size_t threads, const char* output) {
+    int res = OK;
+    char dir[MAX_PATH];
+    char name[MAX_PATH];
+    snprintf(dir, MAX_PATH, "%s", input);
+    snprintf(name, MAX_PATH, "%s", input);
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, dirname(dir), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        LOG_E("Failed to watch %s", input);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return E_WATCH;
+    }
+
+    Source sources[2] = {{.text = NULL}, {.text = NULL}};
+    Source* previous = &sources[0];
+    Source* source = &sources[1];
+    Scene* scene = create_scene();
+    _width = width;
+    _height = height;
+    _stride = bitmap_stride(width);
+    _image = calloc(bitmap_size(width, height), 1);
+    if (scene == NULL || _image == NULL) {
+        res = E_ALLOC;
+    } else {
+        write_bitmap_headers(_image, width, height);
+        double start = now_ms();
+        res = read_source(input, previous);
+        if (res == OK) {
+            res = render_whole(scene, previous, threads);
+        }
+        if (res == OK) {
+            res = write_output(output);
+        }
+        if (res == OK) {
+            fprintf(stderr, "Rendered %s in %.1f ms, watching it\n", input, now_ms() - start);
+        }
+    }
+
+    const char* file = basename(name);
+    while (res == OK && (res = wait_change(fd, file)) == OK) {
+        double start = now_ms();
+        if (read_source(input, source) != OK) {
+            continue; // Being replaced, the next event reads it
+        }
+        int changed = -1;
+        if (same_structure(previous, source)) {
+            changed = render_changes(scene, previous, source);
+        }
+        if (changed < 0) {
+            // Also when a layer failed to parse, as it is left incomplete
+            if (render_whole(scene, source, threads) == OK && write_output(output) == OK) {
+                fprintf(stderr, "Read %s again whole, in %.1f ms\n", input, now_ms() - start);
+            }
+        } else if (changed > 0 && write_output(output) == OK) {
+            fprintf(stderr, "Parsed %d layers of %s again, in %.1f ms\n", changed, input, now_ms() - start);
+        }
+        free(previous->text);
+        previous->text = NULL;
+        Source* swap = previous;
+        previous = source;
+        source = swap;
+    }
+
+    close(fd);
+    free(sources[0].text);
+    free(sources[1].text);
+    free(_image);
+    _image = NULL;
+    if (scene) {
+        destroy_scene(scene);
+    }
+    return res;
+}
@@ -0,0 +1,22 @@
+/*
+    Author: Hugo Roussel, unless indicated otherwise.
+    License: MIT, with parts in CC BY-SA 4.0.
+
+    Render a scene again each time its file is saved, parsing and rendering again only the layers that changed.
+*/
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "sys/types.h"
+
+#include "render.h"
+
+#define E_WATCH -102
+
+// Render input to output, then wait for input to change, until the process is stopped. The instructions are split
+// in sections, each starting at a LAYER or GROUP line. When only layer sections changed, those layers alone are parsed
+// again, and the regions they left or reached rendered again. Any other change reads the whole scene again.
+// output is replaced at once, by renaming a temporary file next to it.
+extern int render_watch(const char* input, size_t width, size_t height, size_t threads, const char* output);
+
+#endif
@@ -12,7 +12,7 @@
 
 #include "../render.h"
 
-int version() {return 6;}
+int version() {return 8;}
 
 void print(char* msg) {
     EM_ASM({
@@ -93,6 +93,59 @@ unsigned char* create_result_buffer(int width, int height) {
     return pixels_buffer;
 }
 
+// See the presets in render.h
+int set_preset(int preset) {
+    RenderParams params;
+    int res = get_render_preset(preset, &params);
+    if (res == OK) {
+        res = set_render_params(&params);
+    }
+    return res;
+}
+
 int render() {
     return read_and_render(canvas_width, canvas_height, &read_line, &handle_pixel, &print);
 }
+
+/* Progressive render, the page calls render_next_pass once per animation frame to show each pass */
+Scene* progressive_scene = NULL;
+float* progressive_seeds = NULL; // See render_pass
+int next_pass = 0;
+
+void end_progressive() {
+    if (progressive_scene) {
+        destroy_scene(progressive_scene);
+    }
+    progressive_scene = NULL;
+    if (progressive_seeds) {
+        free(progressive_seeds);
+    }
+    progressive_seeds = NULL;
+}
+
+// Read the loaded instructions, for the size of the result buffer
+int begin_progressive() {
+    end_progressive();
+    set_message_callback(&print);
+    progressive_scene = create_scene();
+    progressive_seeds = malloc(sizeof(float) * canvas_width * canvas_height);
+    if (progressive_scene == NULL || progressive_seeds == NULL) {
+        end_progressive();
+        return E_ALLOC;
+    }
+    next_pass = 0;
+    return read_scene(progressive_scene, canvas_width, canvas_height, &read_line);
+}
+
+// Render the next pass in the result buffer, and return its index, from 0 to PROGRESSIVE_PASSES - 1.
+// Return -1 when there is none left, or it failed.
+int render_next_pass() {
+    if (progressive_scene == NULL || next_pass >= PROGRESSIVE_PASSES) {
+        return -1;
+    }
+    if (render_pass(progressive_scene, canvas_width, canvas_height, next_pass, progressive_seeds, &handle_pixel) != OK) {
+        return -1;
+    }
+    return next_pass++;
+}
+/* === */